@@ -0,0 +1,191 @@
+// Kernel micro-benchmarks.
+// These run at boot when `run_benchmarks` is set in main.zig's `kernel_flags`, and print their results to the early console.
+
+const std = @import("std");
+const platform = @import("platform.zig");
+const time = @import("time.zig");
+const util = @import("util.zig");
+const vfs = @import("vfs.zig");
+
+const tmpfs = @import("fs/tmpfs.zig");
+
+const Node = vfs.Node;
+
+fn report(name: []const u8, count: usize, start: i64) void {
+    var elapsed = time.getClockNano(.monotonic) - start;
+    platform.earlyprintf("bench: {}: {} ops in {} us\r\n", .{ name, count, @divFloor(elapsed, std.time.ns_per_us) });
+}
+
+/// Mount a fresh tmpfs for one benchmark. Give it back with `unmountScratch`.
+fn mountScratch(allocator: *std.mem.Allocator) !*Node {
+    var root = try tmpfs.Fs.mount(allocator, null, null);
+    try root.open();
+    return root;
+}
+
+/// Unmount a tmpfs from `mountScratch`, freeing whatever the benchmark left in it.
+fn unmountScratch(root: *Node) void {
+    // Our reference to the root should be the last one, so closing it unmounts.
+    std.debug.assert(root.file_system.?.opens.refs == 1);
+    root.close() catch {};
+}
+
+/// Create, look up and delete `count` files in a single tmpfs directory.
+pub fn tmpfsDirectory(allocator: *std.mem.Allocator, count: usize) !void {
+    var root = try mountScratch(allocator);
+    defer unmountScratch(root);
+
+    var name_buf: [32]u8 = undefined;
+
+    var start = time.getClockNano(.monotonic);
+    var i: usize = 0;
+    while (i < count) : (i += 1) {
+        var file = try root.create(try std.fmt.bufPrint(name_buf[0..], "file{}", .{i}), .file, Node.Mode.all);
+        try file.node.close();
+    }
+    report("tmpfs create", count, start);
+
+    var usage = root.file_system.?.stat();
+    platform.earlyprintf("bench: tmpfs usage: {} bytes, {} inodes\r\n", .{ usage.bytes_used, usage.inodes_used });
+
+    start = time.getClockNano(.monotonic);
+    i = 0;
+    while (i < count) : (i += 1) {
+        var file = try root.find(try std.fmt.bufPrint(name_buf[0..], "file{}", .{i}));
+        try file.node.close();
+    }
+    report("tmpfs find", count, start);
+
+    start = time.getClockNano(.monotonic);
+    i = 0;
+    while (i < count) : (i += 1) {
+        try root.unlink(try std.fmt.bufPrint(name_buf[0..], "file{}", .{i}));
+    }
+    report("tmpfs unlink", count, start);
+}
+
+/// Grow one tmpfs file to `size` bytes with 4 KB appends, then read it back.
+pub fn tmpfsAppend(allocator: *std.mem.Allocator, size: usize) !void {
+    var root = try mountScratch(allocator);
+    defer unmountScratch(root);
+
+    var file = try root.create("log", .file, Node.Mode.all);
+    defer file.node.close() catch {};
+
+    var block: [4096]u8 = undefined;
+    std.mem.set(u8, block[0..], 'x');
+
+    var start = time.getClockNano(.monotonic);
+    var offset: usize = 0;
+    while (offset < size) : (offset += block.len) {
+        _ = try file.node.write(offset, block[0..]);
+    }
+    report("tmpfs append 4K", size / block.len, start);
+
+    start = time.getClockNano(.monotonic);
+    offset = 0;
+    while (offset < size) : (offset += block.len) {
+        _ = try file.node.read(offset, block[0..]);
+    }
+    report("tmpfs read 4K", size / block.len, start);
+}
+
+/// In-memory stand-in for a block device driver: only implements readPage/writePage, so every access
+/// goes through the PageCache.
+const PagedStore = struct {
+    const ops: Node.Ops = .{
+        .readPage = PagedStore.readPage,
+        .writePage = PagedStore.writePage,
+    };
+
+    data: []u8,
+
+    fn readPage(self: *Node, index: u64, page: *align(vfs.page_size) [vfs.page_size]u8) !usize {
+        var store = self.cookie.?.as(PagedStore);
+        var start = index * vfs.page_size;
+        if (start >= self.stat.size) return 0;
+        var len = @truncate(usize, std.math.min(vfs.page_size, self.stat.size - start));
+        std.mem.copy(u8, page[0..len], store.data[@truncate(usize, start)..][0..len]);
+        return len;
+    }
+
+    fn writePage(self: *Node, index: u64, page: *align(vfs.page_size) const [vfs.page_size]u8, len: usize) !void {
+        var store = self.cookie.?.as(PagedStore);
+        var start = index * vfs.page_size;
+        if (start + len > store.data.len) return vfs.Error.NoSpace;
+        std.mem.copy(u8, store.data[@truncate(usize, start)..][0..len], page[0..len]);
+    }
+};
+
+fn readBack(node: *Node, size: usize, block: []u8) !void {
+    var offset: usize = 0;
+    while (offset < size) : (offset += block.len) {
+        if ((try node.read(offset, block)) != block.len) return error.ShortRead;
+        for (block) |byte| {
+            if (byte != @truncate(u8, offset / block.len)) return error.BadData;
+        }
+    }
+}
+
+/// Write a `size`-byte file through the PageCache and read it back, first with the normal budget and
+/// then with one no bigger than read-ahead, so that every miss has to evict. Checks the data both times.
+pub fn pageCache(allocator: *std.mem.Allocator, size: usize) !void {
+    var store = PagedStore{ .data = try allocator.alloc(u8, size) };
+    defer allocator.free(store.data);
+
+    var node = Node.init(PagedStore.ops, util.asCookie(&store), Node.Stat{ .type = .file }, null);
+    try node.open();
+    defer node.close() catch {};
+
+    var block: [vfs.page_size]u8 = undefined;
+
+    var start = time.getClockNano(.monotonic);
+    var offset: usize = 0;
+    while (offset < size) : (offset += block.len) {
+        std.mem.set(u8, block[0..], @truncate(u8, offset / block.len));
+        _ = try node.write(offset, block[0..]);
+    }
+    try node.sync();
+    report("page cache write 4K", size / block.len, start);
+
+    try vfs.PageCache.release(&node);
+    var hits = vfs.PageCache.hits;
+    var misses = vfs.PageCache.misses;
+    start = time.getClockNano(.monotonic);
+    try readBack(&node, size, block[0..]);
+    report("page cache read 4K", size / block.len, start);
+    platform.earlyprintf("bench: page cache: {} hits, {} misses\r\n", .{ vfs.PageCache.hits - hits, vfs.PageCache.misses - misses });
+
+    var budget = vfs.PageCache.budget_pages;
+    defer vfs.PageCache.budget_pages = budget;
+    vfs.PageCache.budget_pages = vfs.PageCache.read_ahead_pages;
+
+    try vfs.PageCache.release(&node);
+    start = time.getClockNano(.monotonic);
+    try readBack(&node, size, block[0..]);
+    report("page cache read 4K, small budget", size / block.len, start);
+}
+
+/// Print `count` lines to the early console, which is the framebuffer console if that's enabled.
+/// Compare runs with and without `framebuffer_console` to see what drawing the text ourselves buys.
+pub fn consoleLines(count: usize) void {
+    var start = time.getClockNano(.monotonic);
+    var i: usize = 0;
+    while (i < count) : (i += 1) {
+        platform.earlyprintf("bench: console line {} of {}, padded out to a typical log line's length\r\n", .{ i + 1, count });
+    }
+    report(if (platform.openFramebuffer() != null) "framebuffer console lines" else "firmware console lines", count, start);
+}
+
+pub fn runAll(allocator: *std.mem.Allocator) void {
+    tmpfsDirectory(allocator, 100000) catch |err| {
+        platform.earlyprintf("bench: tmpfs directory failed: {}\r\n", .{@errorName(err)});
+    };
+    tmpfsAppend(allocator, 64 * 1024 * 1024) catch |err| {
+        platform.earlyprintf("bench: tmpfs append failed: {}\r\n", .{@errorName(err)});
+    };
+    pageCache(allocator, 8 * 1024 * 1024) catch |err| {
+        platform.earlyprintf("bench: page cache failed: {}\r\n", .{@errorName(err)});
+    };
+    consoleLines(2000);
+}
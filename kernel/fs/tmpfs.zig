@@ -10,6 +10,7 @@ const Node = vfs.Node;
 const File = vfs.File;
 
 const FileList = std.ArrayList(?File);
+const SlotList = std.ArrayList(usize);
 
 // These **MUST** be inlined.
 inline fn myFsImpl(self: *Node) *FsImpl {
@@ -19,6 +20,279 @@ inline fn myImpl(self: *Node) *NodeImpl {
     return self.cookie.?.as(NodeImpl);
 }
 
+/// Hash index over a directory's `children`, mapping names to slots.
+/// Open addressing with linear probing; stores slot + 1 so that zero means empty.
+const DirIndex = struct {
+    const empty: usize = 0;
+    const tombstone: usize = std.math.maxInt(usize);
+    const min_size = 16;
+
+    table: []usize = &[_]usize{},
+    used: usize = 0, // Live entries plus tombstones
+
+    inline fn hash(name: []const u8) u64 {
+        return std.hash.Wyhash.hash(0, name);
+    }
+
+    // Returns the table position holding `name`, if any.
+    fn position(self: *const DirIndex, children: []const ?File, name: []const u8) ?usize {
+        if (self.table.len == 0) return null;
+
+        var mask = self.table.len - 1;
+        var pos = @truncate(usize, DirIndex.hash(name)) & mask;
+        while (self.table[pos] != empty) : (pos = (pos + 1) & mask) {
+            if (self.table[pos] == tombstone) continue;
+            if (std.mem.eql(u8, children[self.table[pos] - 1].?.name(), name)) return pos;
+        }
+        return null;
+    }
+
+    pub fn lookup(self: *const DirIndex, children: []const ?File, name: []const u8) ?usize {
+        var pos = self.position(children, name) orelse return null;
+        return self.table[pos] - 1;
+    }
+
+    // `name` must not already be present. `children[slot]` must already hold the new entry.
+    pub fn insert(self: *DirIndex, allocator: *std.mem.Allocator, children: []const ?File, slot: usize) !void {
+        // Rehashing walks `children`, which picks up the new entry too.
+        if ((self.used + 1) * 4 > self.table.len * 3) return self.rehash(allocator, children);
+
+        var mask = self.table.len - 1;
+        var pos = @truncate(usize, DirIndex.hash(children[slot].?.name())) & mask;
+        while (self.table[pos] != empty and self.table[pos] != tombstone) pos = (pos + 1) & mask;
+
+        if (self.table[pos] == empty) self.used += 1;
+        self.table[pos] = slot + 1;
+    }
+
+    pub fn remove(self: *DirIndex, children: []const ?File, name: []const u8) void {
+        var pos = self.position(children, name) orelse return;
+        self.table[pos] = tombstone;
+    }
+
+    // Rebuild from `children` at under half load, dropping tombstones on the way.
+    fn rehash(self: *DirIndex, allocator: *std.mem.Allocator, children: []const ?File) !void {
+        var live: usize = 0;
+        for (children) |child| {
+            if (child != null) live += 1;
+        }
+
+        var new_size: usize = min_size;
+        while (new_size < live * 2) new_size *= 2;
+
+        var new_table = try allocator.alloc(usize, new_size);
+        std.mem.set(usize, new_table, empty);
+
+        var mask = new_size - 1;
+        for (children) |child, slot| {
+            if (child == null) continue;
+            var pos = @truncate(usize, DirIndex.hash(child.?.name())) & mask;
+            while (new_table[pos] != empty) pos = (pos + 1) & mask;
+            new_table[pos] = slot + 1;
+        }
+
+        self.deinit(allocator);
+        self.table = new_table;
+        self.used = live;
+    }
+
+    pub fn deinit(self: *DirIndex, allocator: *std.mem.Allocator) void {
+        if (self.table.len > 0) allocator.free(self.table);
+        self.* = .{};
+    }
+};
+
+/// Backing store for file data and the PageTree interior pages that index it, so `limit` and `used`
+/// count both. Pages come straight from the platform page allocator and go back to it as soon as they're freed.
+const PagePool = struct {
+    pub const Page = [platform.page_size]u8;
+
+    limit: ?usize = null, // In pages; null means "as much as the system will give us"
+    used: usize = 0,
+
+    pub fn alloc(self: *PagePool) !*align(platform.page_size) Page {
+        if (self.limit != null and self.used >= self.limit.?) return vfs.Error.NoSpace;
+        var ptr = platform.allocPages(1) orelse return error.OutOfMemory;
+        self.used += 1;
+        return @ptrCast(*align(platform.page_size) Page, ptr);
+    }
+
+    pub fn free(self: *PagePool, page: *align(platform.page_size) Page) void {
+        platform.freePages(@ptrCast([*]align(platform.page_size) u8, page), 1);
+        self.used -= 1;
+    }
+};
+
+/// File contents, stored as a radix tree of fixed-size pages.
+/// Pages that were never written are holes and read back as zeros. Growing a file only
+/// ever allocates new pages, so appending costs the same no matter how large the file is.
+const PageTree = struct {
+    pub const page_size = platform.page_size;
+    const fanout_bits = 9;
+    const fanout = 1 << fanout_bits;
+
+    const Page = PagePool.Page;
+    // Slots hold either *Interior or *Page (at the bottom level) as integers; zero means a hole.
+    // Interior nodes are exactly one page, so both come from the same PagePool.
+    const Interior = struct { slots: [fanout]usize = [_]usize{0} ** fanout };
+
+    root: usize = 0,
+    height: u8 = 0, // 0: empty, 1: root is a Page, n: root is an Interior n - 1 levels above the pages
+    len: u64 = 0,
+    n_pages: usize = 0, // Data pages only
+
+    comptime {
+        util.compAssert(@sizeOf(Interior) == page_size);
+    }
+
+    // Number of pages addressable at `height`.
+    fn capacity(height: u8) u64 {
+        if (height == 0) return 0;
+        var bits = @as(u64, height - 1) * fanout_bits;
+        if (bits >= 64) return std.math.maxInt(u64);
+        return @as(u64, 1) << @intCast(u6, bits);
+    }
+
+    inline fn slotIndex(index: u64, level: u8) usize {
+        return @truncate(usize, (index >> @intCast(u6, @as(u64, level - 1) * fanout_bits)) & (fanout - 1));
+    }
+
+    fn newInterior(pool: *PagePool) !*Interior {
+        var interior = @ptrCast(*Interior, try pool.alloc());
+        interior.* = .{};
+        return interior;
+    }
+
+    pub fn lookup(self: *const PageTree, index: u64) ?*Page {
+        if (index >= PageTree.capacity(self.height)) return null;
+
+        var node = self.root;
+        var level = self.height - 1;
+        while (level > 0 and node != 0) : (level -= 1) {
+            node = @intToPtr(*Interior, node).slots[PageTree.slotIndex(index, level)];
+        }
+        return if (node == 0) null else @intToPtr(*Page, node);
+    }
+
+    pub fn getOrCreate(self: *PageTree, pool: *PagePool, index: u64) !*Page {
+        while (index >= PageTree.capacity(self.height)) {
+            if (self.root != 0) {
+                var new_root = try PageTree.newInterior(pool);
+                new_root.slots[0] = self.root;
+                self.root = @ptrToInt(new_root);
+            }
+            self.height += 1;
+        }
+
+        var slot = &self.root;
+        var level = self.height - 1;
+        while (level > 0) : (level -= 1) {
+            if (slot.* == 0) slot.* = @ptrToInt(try PageTree.newInterior(pool));
+            slot = &@intToPtr(*Interior, slot.*).slots[PageTree.slotIndex(index, level)];
+        }
+
+        if (slot.* == 0) {
+            var page = try pool.alloc();
+            std.mem.set(u8, page[0..], 0);
+            slot.* = @ptrToInt(page);
+            self.n_pages += 1;
+        }
+        return @intToPtr(*Page, slot.*);
+    }
+
+    pub fn read(self: *const PageTree, offset: u64, buffer: []u8) usize {
+        if (offset >= self.len) return 0;
+        var end = offset + std.math.min(buffer.len, self.len - offset);
+
+        var pos = offset;
+        while (pos < end) {
+            var page_off = @truncate(usize, pos % page_size);
+            var amount = @truncate(usize, std.math.min(end - pos, page_size - page_off));
+            var out = buffer[@truncate(usize, pos - offset)..][0..amount];
+
+            if (self.lookup(pos / page_size)) |page| {
+                std.mem.copy(u8, out, page[page_off .. page_off + amount]);
+            } else {
+                std.mem.set(u8, out, 0);
+            }
+            pos += amount;
+        }
+        return @truncate(usize, end - offset);
+    }
+
+    pub fn write(self: *PageTree, pool: *PagePool, offset: u64, buffer: []const u8) !usize {
+        var end = std.math.add(u64, offset, buffer.len) catch return vfs.Error.FileTooBig;
+
+        var pos = offset;
+        while (pos < end) {
+            var page_off = @truncate(usize, pos % page_size);
+            var amount = @truncate(usize, std.math.min(end - pos, page_size - page_off));
+
+            // Like a short write(2): report what made it in, and let the retry hit the error.
+            var page = self.getOrCreate(pool, pos / page_size) catch |err| if (pos > offset) break else return err;
+            std.mem.copy(u8, page[page_off .. page_off + amount], buffer[@truncate(usize, pos - offset)..][0..amount]);
+
+            pos += amount;
+            if (pos > self.len) self.len = pos;
+        }
+        return @truncate(usize, pos - offset);
+    }
+
+    // Free `node` and everything under it. Returns how many data pages that was.
+    fn freeLevel(pool: *PagePool, node: usize, level: u8) usize {
+        if (node == 0) return 0;
+        var freed: usize = if (level == 0) 1 else 0;
+        if (level > 0) {
+            for (@intToPtr(*Interior, node).slots) |child| {
+                freed += PageTree.freeLevel(pool, child, level - 1);
+            }
+        }
+        pool.free(@intToPtr(*align(platform.page_size) Page, node));
+        return freed;
+    }
+
+    // Free every data page with an index of `first` or more under `slot`, whose subtree starts at page `base`.
+    // Interior pages are kept even if they end up empty; they go when the whole tree does.
+    fn freeFrom(self: *PageTree, pool: *PagePool, slot: *usize, level: u8, base: u64, first: u64) void {
+        if (slot.* == 0) return;
+        if (base >= first) {
+            self.n_pages -= PageTree.freeLevel(pool, slot.*, level);
+            slot.* = 0;
+            return;
+        }
+        if (level == 0) return;
+
+        var child_span = PageTree.capacity(level);
+        for (@intToPtr(*Interior, slot.*).slots) |*child, i| {
+            var child_base = std.math.add(u64, base, std.math.mul(u64, i, child_span) catch break) catch break;
+            if (child_base < first and first - child_base >= child_span) continue; // Entirely before the cut
+            self.freeFrom(pool, child, level - 1, child_base, first);
+        }
+    }
+
+    /// Set the length to `new_len`, giving back any pages past the new end. Growing just leaves a hole.
+    pub fn truncate(self: *PageTree, pool: *PagePool, new_len: u64) void {
+        if (new_len == 0) return self.deinit(pool);
+
+        if (new_len < self.len and self.height > 0) {
+            var kept_pages = (new_len - 1) / page_size + 1;
+            self.freeFrom(pool, &self.root, self.height - 1, 0, kept_pages);
+
+            // Growing again later has to read zeros here, not what we cut off.
+            var tail = @truncate(usize, new_len % page_size);
+            if (tail != 0) {
+                if (self.lookup(kept_pages - 1)) |page| std.mem.set(u8, page[tail..], 0);
+            }
+        }
+        self.len = new_len;
+    }
+
+    pub fn deinit(self: *PageTree, pool: *PagePool) void {
+        if (self.height > 0) _ = PageTree.freeLevel(pool, self.root, self.height - 1);
+        self.* = .{};
+    }
+};
+
 const NodeImpl = struct {
     const ops: Node.Ops = .{
         .open = NodeImpl.open,
@@ -26,6 +300,7 @@ const NodeImpl = struct {
 
         .read = NodeImpl.read,
         .write = NodeImpl.write,
+        .truncate = NodeImpl.truncate,
 
         .find = NodeImpl.find,
         .create = NodeImpl.create,
@@ -36,20 +311,33 @@ const NodeImpl = struct {
         .unlink_me = NodeImpl.unlink_me,
     };
 
+    // Directory entries never move once added: unlinking leaves a null behind for the
+    // next create to reuse. That keeps slot numbers valid as readDir cookies.
     children: ?FileList = null,
-    data: ?[]u8 = null,
+    free_slots: ?SlotList = null,
+    index: DirIndex = .{},
+    n_children: usize = 0,
+
+    data: ?PageTree = null,
     n_links: RefCount = .{},
 
+    // Every live node in the filesystem, so unmounting can free whatever is left.
+    node: *Node = undefined,
+    prev: ?*NodeImpl = null,
+    next: ?*NodeImpl = null,
+
     pub fn init(file_system: *vfs.FileSystem, typ: Node.Type, initial_stat: Node.Stat) !*Node {
         var fs_impl = file_system.cookie.?.as(FsImpl);
 
         var node_impl = try fs_impl.file_allocator.create(NodeImpl);
         errdefer fs_impl.file_allocator.destroy(node_impl);
+        node_impl.* = .{};
 
         if (typ == .directory) {
             node_impl.children = FileList.init(fs_impl.file_allocator);
+            node_impl.free_slots = SlotList.init(fs_impl.file_allocator);
         } else if (typ == .file) {
-            node_impl.data = try fs_impl.file_allocator.alloc(u8, 0);
+            node_impl.data = PageTree{};
         } else {
             unreachable;
         }
@@ -60,10 +348,17 @@ const NodeImpl = struct {
         var true_initial_stat = initial_stat;
         true_initial_stat.inode = fs_impl.inode_count;
         true_initial_stat.type = typ;
-        true_initial_stat.size = @sizeOf(NodeImpl) + @sizeOf(Node);
+        true_initial_stat.size = if (typ == .file) 0 else @sizeOf(NodeImpl) + @sizeOf(Node);
+        true_initial_stat.blocks = @sizeOf(NodeImpl) + @sizeOf(Node);
 
         fs_impl.inode_count += 1;
         node.* = Node.init(NodeImpl.ops, util.asCookie(node_impl), true_initial_stat, file_system);
+
+        node_impl.node = node;
+        node_impl.next = fs_impl.all_nodes;
+        if (fs_impl.all_nodes) |head| head.prev = node_impl;
+        fs_impl.all_nodes = node_impl;
+        fs_impl.inodes_used += 1;
         return node;
     }
 
@@ -75,11 +370,17 @@ const NodeImpl = struct {
 
         if (node_impl.children != null) {
             node_impl.children.?.deinit();
+            node_impl.free_slots.?.deinit();
+            node_impl.index.deinit(fs_impl.file_allocator);
         }
         if (node_impl.data != null) {
-            fs_impl.file_allocator.free(node_impl.data.?);
+            node_impl.data.?.deinit(&fs_impl.pages);
         }
 
+        if (node_impl.prev) |prev| prev.next = node_impl.next else fs_impl.all_nodes = node_impl.next;
+        if (node_impl.next) |next| next.prev = node_impl.prev;
+        fs_impl.inodes_used -= 1;
+
         fs_impl.file_allocator.destroy(node_impl);
         fs_impl.file_allocator.destroy(self);
     }
@@ -100,14 +401,10 @@ const NodeImpl = struct {
     pub fn read(self: *Node, offset: u64, buffer: []u8) !usize {
         var node_impl = myImpl(self);
 
-        if (node_impl.data) |data| {
-            var trueEnd = @truncate(usize, if (offset + buffer.len > data.len) data.len else offset + buffer.len);
-            var trueOff = @truncate(usize, offset);
-
-            std.mem.copy(u8, buffer, data[trueOff..trueEnd]);
-
+        if (node_impl.data) |*data| {
+            var amount = data.read(offset, buffer);
             self.stat.access_time = time.getClockNano(.real);
-            return trueEnd - trueOff;
+            return amount;
         }
         return vfs.Error.NotFile;
     }
@@ -116,23 +413,31 @@ const NodeImpl = struct {
         var node_impl = myImpl(self);
         var fs_impl = myFsImpl(self);
 
-        if (node_impl.data) |data| {
-            var trueData = data;
-            var trueEnd = @truncate(usize, offset + buffer.len);
-            var trueOff = @truncate(usize, offset);
-
-            if (trueEnd > data.len)
-                trueData = try fs_impl.file_allocator.realloc(trueData, trueEnd);
-            std.mem.copy(u8, trueData[trueOff..trueEnd], buffer);
+        if (node_impl.data) |*data| {
+            var written = try data.write(&fs_impl.pages, offset, buffer);
 
             var now = time.getClockNano(.real);
 
             self.stat.access_time = now;
             self.stat.modify_time = now;
-            self.stat.size = trueData.len;
-            self.stat.blocks = trueData.len + @sizeOf(NodeImpl) + @sizeOf(Node);
-            node_impl.data = trueData;
-            return buffer.len;
+            self.stat.size = data.len;
+            self.stat.blocks = data.n_pages * PageTree.page_size + @sizeOf(NodeImpl) + @sizeOf(Node);
+            return written;
+        }
+        return vfs.Error.NotFile;
+    }
+
+    pub fn truncate(self: *Node, size: u64) !void {
+        var node_impl = myImpl(self);
+        var fs_impl = myFsImpl(self);
+
+        if (node_impl.data) |*data| {
+            data.truncate(&fs_impl.pages, size);
+
+            self.stat.modify_time = time.getClockNano(.real);
+            self.stat.size = data.len;
+            self.stat.blocks = data.n_pages * PageTree.page_size + @sizeOf(NodeImpl) + @sizeOf(Node);
+            return;
         }
         return vfs.Error.NotFile;
     }
@@ -140,37 +445,48 @@ const NodeImpl = struct {
     pub fn find(self: *Node, name: []const u8) !File {
         var node_impl = myImpl(self);
         if (node_impl.children) |children| {
-            for (children.items) |child| {
-                if (child == null) continue;
-                if (std.mem.eql(u8, child.?.name(), name)) {
-                    try child.?.open();
-                    return child.?;
-                }
-            }
-            return vfs.Error.NoSuchFile;
+            var slot = node_impl.index.lookup(children.items, name) orelse return vfs.Error.NoSuchFile;
+            var child = children.items[slot].?;
+            try child.node.open();
+            return child;
         }
         return vfs.Error.NotDirectory;
     }
 
-    pub fn create(self: *Node, name: []const u8, typ: Node.Type, mode: Node.Mode) !File {
+    // Put `new_file` in a free slot and index it.
+    fn addChild(self: *Node, new_file: File) !void {
+        var node_impl = myImpl(self);
         var fs_impl = myFsImpl(self);
+        var children = &node_impl.children.?;
+
+        var slot = node_impl.free_slots.?.popOrNull() orelse blk: {
+            try children.append(null);
+            break :blk children.items.len - 1;
+        };
+        errdefer node_impl.free_slots.?.append(slot) catch {};
+
+        children.items[slot] = new_file;
+        errdefer children.items[slot] = null;
+
+        try node_impl.index.insert(fs_impl.file_allocator, children.items, slot);
+        node_impl.n_children += 1;
+    }
+
+    pub fn create(self: *Node, name: []const u8, typ: Node.Type, mode: Node.Mode) !File {
         var node_impl = myImpl(self);
         if (node_impl.children) |children| {
-            for (children.items) |child| {
-                if (std.mem.eql(u8, child.?.name(), name)) return vfs.Error.FileExists;
-            }
+            if (name.len > vfs.max_name_len) return vfs.Error.NameTooLong;
+            if (node_impl.index.lookup(children.items, name) != null) return vfs.Error.FileExists;
 
             var now = time.getClockNano(.real);
 
             var new_node = try NodeImpl.init(self.file_system.?, typ, .{ .mode = mode, .links = 1, .access_time = now, .create_time = now, .modify_time = now });
             errdefer NodeImpl.deinit(new_node);
 
-            var new_file: File = undefined;
+            var new_file = File{ .name_ptr = null, .node = new_node, .name_len = name.len };
             std.mem.copy(u8, new_file.name_buf[0..], name);
 
-            new_file.name_len = name.len;
-            new_file.node = new_node;
-            try node_impl.children.?.append(new_file);
+            try NodeImpl.addChild(self, new_file);
             myImpl(new_node).n_links.ref();
 
             try new_node.open();
@@ -181,20 +497,20 @@ const NodeImpl = struct {
 
     pub fn link(self: *Node, name: []const u8, new_node: *Node) !File {
         var node_impl = myImpl(self);
-        if (node_impl.children != null) {
-            if (NodeImpl.find(self, name) catch null != null) return vfs.Error.FileExists;
-            var new_file: File = undefined;
+        if (node_impl.children) |children| {
+            if (name.len > vfs.max_name_len) return vfs.Error.NameTooLong;
+            if (node_impl.index.lookup(children.items, name) != null) return vfs.Error.FileExists;
+
+            var new_file = File{ .name_ptr = null, .node = new_node, .name_len = name.len };
             std.mem.copy(u8, new_file.name_buf[0..], name);
 
-            new_file.name_len = name.len;
-            new_file.node = new_node;
+            try NodeImpl.addChild(self, new_file);
+
             if (new_node.file_system == self.file_system) {
                 myImpl(new_node).n_links.ref();
             } else if (new_node.stat.flags.mount_point) {
                 try new_node.open();
             }
-
-            try node_impl.children.?.append(new_file);
             return new_file;
         }
         return vfs.Error.NotDirectory;
@@ -203,16 +519,19 @@ const NodeImpl = struct {
     pub fn unlink(self: *Node, name: []const u8) !void {
         var node_impl = myImpl(self);
         if (node_impl.children) |children| {
-            for (children.items) |child, i| {
-                if (std.mem.eql(u8, child.?.name(), name)) {
-                    if (child.?.node.ops.unlink_me) |unlink_me_fn| {
-                        try unlink_me_fn(child.?.node);
-                    }
-                    _ = node_impl.children.?.swapRemove(i);
-                    return;
-                }
+            var slot = node_impl.index.lookup(children.items, name) orelse return vfs.Error.NoSuchFile;
+            var child = children.items[slot].?;
+
+            if (child.node.ops.unlink_me) |unlink_me_fn| {
+                try unlink_me_fn(child.node);
             }
-            return vfs.Error.NoSuchFile;
+
+            node_impl.index.remove(children.items, name);
+            children.items[slot] = null;
+            node_impl.n_children -= 1;
+            // Can't fail: the list only ever holds as many slots as `children` once had.
+            node_impl.free_slots.?.append(slot) catch {};
+            return;
         }
         return vfs.Error.NotDirectory;
     }
@@ -221,10 +540,13 @@ const NodeImpl = struct {
         var node_impl = myImpl(self);
         if (node_impl.children) |children| {
             var total: usize = 0;
-            for (children.items) |child, i| {
-                if (i < offset) continue;
-                if (total == files.len) break;
-                files[total] = child.?;
+            var slot = @truncate(usize, offset);
+            while (slot < children.items.len and total < files.len) : (slot += 1) {
+                if (children.items[slot] == null) continue;
+                files[total] = children.items[slot].?;
+                files[total].dir_cookie = slot + 1;
+                files[total].inode = files[total].node.stat.inode;
+                files[total].type = files[total].node.stat.type;
                 total += 1;
             }
             return total;
@@ -235,8 +557,8 @@ const NodeImpl = struct {
     pub fn unlink_me(self: *Node) !void {
         var node_impl = myImpl(self);
 
-        if (node_impl.children) |children| {
-            if (children.items.len != 0) return vfs.Error.NotEmpty;
+        if (node_impl.children != null) {
+            if (node_impl.n_children != 0) return vfs.Error.NotEmpty;
         }
 
         node_impl.n_links.unref();
@@ -249,27 +571,45 @@ const NodeImpl = struct {
     }
 };
 
+/// Mount arguments:
+///   size=N[K|M|G]  cap the space used by file data, page tables included (default: no cap beyond system memory)
 const FsImpl = struct {
     const ops: vfs.FileSystem.Ops = .{
         .mount = FsImpl.mount,
+        .unmount = FsImpl.unmount,
+        .stat = FsImpl.stat,
     };
 
+    const node_overhead = @sizeOf(NodeImpl) + @sizeOf(Node);
+
     file_allocator: *std.mem.Allocator,
-    maybe_fba: std.heap.FixedBufferAllocator,
-    maybe_fba_data: []u8,
-    inode_count: u64,
+    pages: PagePool = .{},
+    all_nodes: ?*NodeImpl = null,
+    inode_count: u64 = 1, // Next inode number to hand out
+    inodes_used: u64 = 0,
+
+    fn parseSize(str: []const u8) !u64 {
+        if (str.len == 0) return error.InvalidSize;
+        var multiplier: u64 = switch (str[str.len - 1]) {
+            'k', 'K' => 1024,
+            'm', 'M' => 1024 * 1024,
+            'g', 'G' => 1024 * 1024 * 1024,
+            else => 1,
+        };
+        var digits = if (multiplier == 1) str else str[0 .. str.len - 1];
+        return std.math.mul(u64, try std.fmt.parseInt(u64, digits, 10), multiplier) catch error.InvalidSize;
+    }
 
     pub fn mount(self: *vfs.FileSystem, unused: ?*Node, args: ?[]const u8) !*Node {
         var fs_impl = try self.allocator.create(FsImpl);
         errdefer self.allocator.destroy(fs_impl);
 
-        fs_impl.inode_count = 1;
+        // Node metadata lives on the kernel heap so that deleting files gives memory back.
+        fs_impl.* = .{ .file_allocator = &platform.heap_allocator };
 
-        fs_impl.maybe_fba_data = try self.allocator.alloc(u8, 4 * 1024 * 1024);
-        errdefer self.allocator.free(fs_impl.maybe_fba_data);
-
-        fs_impl.maybe_fba = std.heap.FixedBufferAllocator.init(fs_impl.maybe_fba_data);
-        fs_impl.file_allocator = &fs_impl.maybe_fba.allocator;
+        if (vfs.getMountArg(args, "size")) |size_str| {
+            fs_impl.pages.limit = @truncate(usize, (try FsImpl.parseSize(size_str)) / platform.page_size);
+        }
 
         self.cookie = util.asCookie(fs_impl);
 
@@ -278,6 +618,22 @@ const FsImpl = struct {
         var root_node = try NodeImpl.init(self, .directory, .{ .flags = .{ .mount_point = true }, .create_time = now, .access_time = now, .modify_time = now });
         return root_node;
     }
+
+    pub fn unmount(self: *vfs.FileSystem) void {
+        var fs_impl = self.cookie.?.as(FsImpl);
+        while (fs_impl.all_nodes) |node_impl| {
+            NodeImpl.deinit(node_impl.node);
+        }
+    }
+
+    pub fn stat(self: *vfs.FileSystem) vfs.FileSystem.Stat {
+        var fs_impl = self.cookie.?.as(FsImpl);
+        return .{
+            .bytes_used = fs_impl.pages.used * platform.page_size + fs_impl.inodes_used * node_overhead,
+            .bytes_limit = if (fs_impl.pages.limit) |limit| limit * platform.page_size else null,
+            .inodes_used = fs_impl.inodes_used,
+        };
+    }
 };
 
 pub const Fs = vfs.FileSystem.init("tmpfs", FsImpl.ops);
@@ -4,6 +4,7 @@ const time = std.time;
 
 const vfs = @import("../vfs.zig");
 const util = @import("../util.zig");
+const idle = @import("../idle.zig");
 
 const RefCount = util.RefCount;
 
@@ -14,6 +15,12 @@ const c = @cImport({
     @cInclude("miniz/miniz.h");
 });
 /// Support for mounting .zip files as a filesystem. DIRECTORY ENTRIES ARE REQUIRED in the .zip file.
+///
+/// Mount arguments:
+///   prefetch=/a:/b        inflate these files in the background during idle time
+///   prefetch=*            inflate everything in the background
+///   prefetch_manifest=/f  like `prefetch`, but read the list (one path per line) from a file in the archive
+///   cache_size=N          keep at most N bytes of inflated files around (default 16 MiB)
 
 // These **MUST** be inlined.
 inline fn myFsImpl(self: *Node) *FsImpl {
@@ -56,9 +63,8 @@ const NodeImpl = struct {
         if (node_impl.miniz_stat.m_is_directory != 0) return vfs.Error.NotFile;
         if (node_impl.data != null) return;
 
-        node_impl.data = try self.file_system.?.allocator.alloc(u8, node_impl.miniz_stat.m_uncomp_size);
-        var mz_ok = c.mz_zip_reader_extract_to_mem(&fs_impl.archive, node_impl.miniz_stat.m_file_index, node_impl.data.?.ptr, node_impl.data.?.len, 0);
-        if (mz_ok == 0) return vfs.Error.ReadFailed;
+        node_impl.data = try fs_impl.extract(self.file_system.?, node_impl.miniz_stat.m_file_index);
+        fs_impl.pin(node_impl.miniz_stat.m_file_index);
     }
 
     pub fn init(file_system: *vfs.FileSystem, index: u32, preinit_stat: ?c.mz_zip_archive_file_stat) !*Node {
@@ -94,7 +100,8 @@ const NodeImpl = struct {
         var node_impl = myImpl(self);
 
         if (self.opens.refs == 0) {
-            if (node_impl.data != null) self.file_system.?.allocator.free(node_impl.data.?);
+            // node_impl.data belongs to the filesystem's extraction cache; just let it be evicted again.
+            if (node_impl.data != null) myFsImpl(self).unpin(node_impl.miniz_stat.m_file_index);
             if (!self.stat.flags.mount_point) _ = myFsImpl(self).opened.remove(node_impl.miniz_stat.m_file_index);
             self.file_system.?.allocator.destroy(node_impl);
             self.file_system.?.allocator.destroy(self);
@@ -201,7 +208,8 @@ const NodeImpl = struct {
 
             path_slice = path_slice[my_path.len..];
 
-            if (std.mem.endsWith(u8, path_slice, "/")) {
+            var is_dir = std.mem.endsWith(u8, path_slice, "/");
+            if (is_dir) {
                 path_slice = path_slice[0 .. path_slice.len - 1];
             }
             if (std.mem.indexOf(u8, path_slice, "/") != null) {
@@ -209,9 +217,13 @@ const NodeImpl = struct {
                 continue;
             }
 
-            var file: File = undefined;
-            std.mem.copy(u8, file.name_buf[0..], path_slice[my_path.len..]);
-            file.name_len = path_slice.len - my_path.len;
+            var file = File{ .node = undefined, .name_ptr = null };
+            std.mem.copy(u8, file.name_buf[0..], path_slice);
+            file.name_len = path_slice.len;
+
+            file.dir_cookie = total_index + 1;
+            file.inode = total_index + 2; // Same numbering as NodeImpl.init
+            file.type = if (is_dir) .directory else .file;
 
             files[true_index] = file;
 
@@ -228,6 +240,15 @@ const NodeImpl = struct {
 
 const FsImpl = struct {
     const OpenedCache = std.AutoHashMap(u32, *Node);
+    const ExtractedCache = std.AutoHashMap(u32, Extracted);
+
+    const Extracted = struct {
+        data: []u8,
+        pins: usize = 0, // Nodes reading straight out of `data`; it can't be evicted while there are any
+        last_use: u64 = 0,
+    };
+
+    const default_cache_size = 16 * 1024 * 1024;
 
     const ops: vfs.FileSystem.Ops = .{
         .mount = FsImpl.mount,
@@ -238,6 +259,141 @@ const FsImpl = struct {
     archive: c.mz_zip_archive = undefined,
     opened: FsImpl.OpenedCache = undefined,
 
+    // Inflated file contents, keyed by file index. Survives the nodes themselves,
+    // so the second exec of a binary doesn't inflate it again. Lives outside the
+    // filesystem's arena, so that evicting an entry actually gives the memory back.
+    extracted: FsImpl.ExtractedCache = undefined,
+    extracted_bytes: usize = 0,
+    cache_size: usize = FsImpl.default_cache_size,
+    use_clock: u64 = 0,
+
+    prefetch_queue: std.ArrayList(u32) = undefined,
+    prefetch_work: idle.Work = idle.Work.init(FsImpl.prefetchStep, null),
+
+    fn extract(self: *FsImpl, file_system: *vfs.FileSystem, index: u32) ![]u8 {
+        self.use_clock += 1;
+        if (self.extracted.getEntry(index)) |entry| {
+            entry.value.last_use = self.use_clock;
+            return entry.value.data;
+        }
+
+        var file_info: c.mz_zip_archive_file_stat = undefined;
+        var mz_ok = c.mz_zip_reader_file_stat(&self.archive, @truncate(c.mz_uint, index), &file_info);
+        if (mz_ok == 0) return vfs.Error.ReadFailed;
+        if (file_info.m_is_directory != 0) return vfs.Error.NotFile;
+
+        // Pinned files can keep us over budget; that's fine, they're in use.
+        self.evictFor(file_system, file_info.m_uncomp_size);
+
+        var data = try file_system.raw_allocator.alloc(u8, file_info.m_uncomp_size);
+        errdefer file_system.raw_allocator.free(data);
+
+        mz_ok = c.mz_zip_reader_extract_to_mem(&self.archive, index, data.ptr, data.len, 0);
+        if (mz_ok == 0) return vfs.Error.ReadFailed;
+
+        try self.extracted.putNoClobber(index, .{ .data = data, .last_use = self.use_clock });
+        self.extracted_bytes += data.len;
+        return data;
+    }
+
+    fn pin(self: *FsImpl, index: u32) void {
+        self.extracted.getEntry(index).?.value.pins += 1;
+    }
+
+    fn unpin(self: *FsImpl, index: u32) void {
+        self.extracted.getEntry(index).?.value.pins -= 1;
+    }
+
+    fn deinitExtracted(self: *FsImpl, file_system: *vfs.FileSystem) void {
+        for (self.extracted.items()) |entry| file_system.raw_allocator.free(entry.value.data);
+        self.extracted.deinit();
+    }
+
+    // Drop least recently used, unpinned files until `incoming` more bytes fit in the budget.
+    fn evictFor(self: *FsImpl, file_system: *vfs.FileSystem, incoming: usize) void {
+        while (self.extracted_bytes + incoming > self.cache_size) {
+            var victim: ?*FsImpl.ExtractedCache.Entry = null;
+            for (self.extracted.items()) |*entry| {
+                if (entry.value.pins > 0) continue;
+                if (victim == null or entry.value.last_use < victim.?.value.last_use) victim = entry;
+            }
+
+            var entry = victim orelse return;
+            self.extracted_bytes -= entry.value.data.len;
+            file_system.raw_allocator.free(entry.value.data);
+            _ = self.extracted.remove(entry.key);
+        }
+    }
+
+    fn locate(self: *FsImpl, path: []const u8) ?u32 {
+        var path_raw: [1024]u8 = undefined;
+        var trimmed = std.mem.trimLeft(u8, path, "/");
+        if (trimmed.len == 0 or trimmed.len >= path_raw.len) return null;
+
+        std.mem.copy(u8, path_raw[0..], trimmed);
+        path_raw[trimmed.len] = 0;
+
+        var index: u32 = undefined;
+        if (c.mz_zip_reader_locate_file_v2(&self.archive, &path_raw, null, 0, &index) == 0) return null;
+        return index;
+    }
+
+    fn queuePrefetchList(self: *FsImpl, list: []const u8, separators: []const u8) !void {
+        var path_tokenizer = std.mem.tokenize(list, separators);
+        while (path_tokenizer.next()) |path| {
+            var trimmed = std.mem.trim(u8, path, " \t\r");
+            if (trimmed.len == 0 or trimmed[0] == '#') continue;
+            if (self.locate(trimmed)) |index| try self.prefetch_queue.append(index);
+        }
+    }
+
+    fn queuePrefetch(self: *FsImpl, file_system: *vfs.FileSystem, args: ?[]const u8) !void {
+        if (vfs.getMountArg(args, "prefetch")) |list| {
+            if (std.mem.eql(u8, list, "*")) {
+                var index: u32 = 0;
+                while (index < self.archive.m_total_files) : (index += 1) {
+                    if (c.mz_zip_reader_is_file_a_directory(&self.archive, index) == 0) try self.prefetch_queue.append(index);
+                }
+            } else {
+                try self.queuePrefetchList(list, ":");
+            }
+        }
+
+        if (vfs.getMountArg(args, "prefetch_manifest")) |manifest_path| {
+            // A missing manifest isn't an error; there's just nothing to prefetch.
+            if (self.locate(manifest_path)) |index| {
+                try self.queuePrefetchList(try self.extract(file_system, index), "\n");
+            }
+        }
+
+        // Pop from the end, so reverse to keep the order the user asked for.
+        std.mem.reverse(u32, self.prefetch_queue.items);
+
+        if (self.prefetch_queue.items.len > 0) {
+            self.prefetch_work.cookie = util.asCookie(file_system);
+            idle.schedule(&self.prefetch_work);
+        }
+    }
+
+    // Inflate one queued file per call, so we never hold the CPU for long.
+    fn prefetchStep(work: *idle.Work) bool {
+        var file_system = work.cookie.?.as(vfs.FileSystem);
+        var fs_impl = file_system.cookie.?.as(FsImpl);
+
+        var index = fs_impl.prefetch_queue.popOrNull() orelse return false;
+
+        // Prefetching into a full cache would just evict what we prefetched a moment ago, so stop instead.
+        var file_info: c.mz_zip_archive_file_stat = undefined;
+        if (c.mz_zip_reader_file_stat(&fs_impl.archive, @truncate(c.mz_uint, index), &file_info) == 0) return fs_impl.prefetch_queue.items.len > 0;
+        if (fs_impl.extracted_bytes + file_info.m_uncomp_size > fs_impl.cache_size) {
+            fs_impl.prefetch_queue.items.len = 0;
+            return false;
+        }
+
+        _ = fs_impl.extract(file_system, index) catch {};
+        return fs_impl.prefetch_queue.items.len > 0;
+    }
+
     pub fn mount(self: *vfs.FileSystem, zipfile: ?*Node, args: ?[]const u8) anyerror!*Node {
         if (zipfile == null) return vfs.Error.NoSuchFile;
 
@@ -260,8 +416,21 @@ const FsImpl = struct {
         fs_impl.opened = FsImpl.OpenedCache.init(self.allocator);
         errdefer fs_impl.opened.deinit();
 
+        if (vfs.getMountArg(args, "cache_size")) |size_str| {
+            fs_impl.cache_size = try std.fmt.parseInt(usize, size_str, 10);
+        }
+
+        fs_impl.extracted = FsImpl.ExtractedCache.init(self.raw_allocator);
+        errdefer fs_impl.deinitExtracted(self);
+
+        fs_impl.prefetch_queue = std.ArrayList(u32).init(self.raw_allocator);
+        errdefer fs_impl.prefetch_queue.deinit();
+
         self.cookie = util.asCookie(fs_impl);
 
+        try fs_impl.queuePrefetch(self, args);
+        errdefer idle.cancel(&fs_impl.prefetch_work);
+
         var root_node_impl = try self.allocator.create(NodeImpl);
         errdefer self.allocator.destroy(root_node_impl);
 
@@ -287,7 +456,11 @@ const FsImpl = struct {
 
     pub fn unmount(self: *vfs.FileSystem) void {
         var fs_impl = self.cookie.?.as(FsImpl);
+        idle.cancel(&fs_impl.prefetch_work);
         _ = c.mz_zip_reader_end(&fs_impl.archive);
+
+        fs_impl.deinitExtracted(self);
+        fs_impl.prefetch_queue.deinit();
     }
 };
 
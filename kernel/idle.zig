@@ -0,0 +1,62 @@
+// Idle-time work queue.
+// Anything registered here runs from the kernel main loop in the time we would
+// otherwise spend in `hlt`. Once we have SMP, secondary CPUs should drain this too.
+
+const std = @import("std");
+const util = @import("util.zig");
+
+const Cookie = util.Cookie;
+
+pub const Work = struct {
+    /// Perform one small, bounded unit of work. Return `true` if there is more to do.
+    pub const Fn = fn (work: *Work) bool;
+
+    run: Work.Fn,
+    cookie: Cookie = null,
+
+    next: ?*Work = null,
+    queued: bool = false,
+
+    pub fn init(run: Work.Fn, cookie: Cookie) Work {
+        return .{ .run = run, .cookie = cookie };
+    }
+};
+
+var queue_head: ?*Work = null;
+
+/// Queue `work` to be run during idle time. Queueing twice is harmless.
+pub fn schedule(work: *Work) void {
+    if (work.queued) return;
+    work.queued = true;
+    work.next = queue_head;
+    queue_head = work;
+}
+
+/// Remove `work` from the queue. Must be called before the memory behind `work` goes away.
+pub fn cancel(work: *Work) void {
+    if (!work.queued) return;
+
+    var link = &queue_head;
+    while (link.*) |cur| : (link = &cur.next) {
+        if (cur == work) {
+            link.* = work.next;
+            break;
+        }
+    }
+    work.next = null;
+    work.queued = false;
+}
+
+/// Give every queued piece of work one turn. Returns `false` if there was nothing to do,
+/// in which case the caller is free to halt the CPU.
+pub fn runOnce() bool {
+    if (queue_head == null) return false;
+
+    var cur = queue_head;
+    while (cur) |work| {
+        // Grab this first: `run` may finish and we unlink it below.
+        cur = work.next;
+        if (!work.run(work)) cancel(work);
+    }
+    return true;
+}
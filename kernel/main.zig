@@ -7,6 +7,9 @@ const vfs = @import("vfs.zig");
 const task = @import("task.zig");
 const process = @import("process.zig");
 const time = @import("time.zig");
+const idle = @import("idle.zig");
+const profiler = @import("profiler.zig");
+const benchmarks = @import("benchmarks.zig");
 
 const utsname = @import("utsname.zig");
 
@@ -16,7 +19,12 @@ const zipfs = @import("fs/zipfs.zig");
 var kernel_flags = .{
     .coop_multitask = true, // Run in cooperative multitasking mode
     .save_cpu = true, // Use `hlt` so we don't spike CPU usage
+    .async_console = false, // Queue process console output and write it out during idle time
+    .framebuffer_console = false, // Draw the console on the GOP framebuffer instead of using the firmware's (no serial mirror)
+    .tickless = true, // When every task is blocked, sleep until the next timer instead of waking every tick
+    .run_benchmarks = false, // Run kernel micro-benchmarks at boot
     .init_args = "init\x00default\x00",
+    .initrd_args = "prefetch_manifest=/etc/prefetch", // Inflate common binaries during idle time
 };
 
 extern fn allSanityChecks() callconv(.C) void;
@@ -48,8 +56,9 @@ const initrd_zip = @embedFile("../output/temp/initrd.zip");
 var prochost: process.ProcessHost = undefined;
 var terminated: bool = false;
 
-pub fn timerTick() void {
-    time.tick();
+pub fn timerTick(elapsed: i64) void {
+    time.tick(elapsed);
+    profiler.sample(&prochost);
 
     if (!kernel_flags.coop_multitask) {
         platform.beforeYield();
@@ -60,6 +69,9 @@ pub fn timerTick() void {
 pub fn main() void {
     // Initialize platform
     platform.init();
+    if (kernel_flags.framebuffer_console and !platform.setFramebufferConsole(true)) {
+        platform.earlyprintk("No usable framebuffer; staying on the firmware console.\r\n");
+    }
 
     // Run sanity tests
     platform.earlyprintk("Running hardware integrity tests. If the system crashes during these, that's your problem, not mine.\r\n");
@@ -73,6 +85,7 @@ pub fn main() void {
     platform.earlyprintf("{} {} {} {}\r\n", .{ info.sys_name, info.release, info.version, info.machine });
     platform.earlyprintk("(C) 2020 Ronsor Labs. This software is protected by domestic and international copyright law.\r\n\r\n");
     platform.earlyprintf("Boot timestamp: {}.\r\n", .{ time.getClock(.real) });
+    platform.earlyprintf("Clock resolution: {} ns.\r\n", .{ time.getResolution() });
 
 
     // Create allocator. TODO: good one
@@ -84,7 +97,7 @@ pub fn main() void {
     platform.earlyprintf("Size of initial ramdisk in bytes: {}.\r\n", .{dev_initrd.stat.size});
 
     // TODO: support other formats
-    var rootfs = zipfs.Fs.mount(allocator, &dev_initrd, null) catch @panic("Can't mount initrd!");
+    var rootfs = zipfs.Fs.mount(allocator, &dev_initrd, kernel_flags.initrd_args) catch @panic("Can't mount initrd!");
     platform.earlyprintk("Mounted initial ramdisk.\r\n");
 
     // Setup process host
@@ -92,6 +105,8 @@ pub fn main() void {
 
     platform.setTimer(timerTick);
 
+    if (kernel_flags.run_benchmarks) benchmarks.runAll(allocator);
+
     var init_file = rootfs.findRecursive("/bin/init") catch @panic("Can't find init binary!");
 
     var init_data = allocator.alloc(u8, init_file.node.stat.size) catch @panic("Can't read init binary!");
@@ -99,7 +114,16 @@ pub fn main() void {
 
     platform.earlyprintf("Size of /bin/init in bytes: {}.\r\n", .{init_data.len});
 
+    platform.setAsyncConsole(kernel_flags.async_console);
     var console_node = platform.openConsole();
+    var profile_dir = profiler.openDir(&prochost);
+
+    // Device nodes for init. The framebuffer is only there while the framebuffer console is.
+    var dev_dir = tmpfs.Fs.mount(allocator, null, null) catch @panic("Can't mount /dev!");
+    var framebuffer_node = platform.openFramebuffer();
+    if (framebuffer_node) |*node| {
+        _ = dev_dir.link("fb", node) catch @panic("Can't create /dev/fb!");
+    }
     _ = console_node.write(0, "Initialized /dev/console.\r\n") catch @panic("Can't initialize early console!");
 
     var init_proc_options = process.Process.Arg{
@@ -111,6 +135,8 @@ pub fn main() void {
             .{ .num = 1, .node = &console_node },
             .{ .num = 2, .node = &console_node },
             .{ .num = 3, .node = rootfs, .preopen = true, .name = "/" },
+            .{ .num = 4, .node = &profile_dir, .preopen = true, .name = "/proc/profile" },
+            .{ .num = 5, .node = dev_dir, .preopen = true, .name = "/dev" },
         },
         .runtime_arg = .{
             .wasm = .{
@@ -122,6 +148,7 @@ pub fn main() void {
     _ = prochost.createProcess(init_proc_options) catch @panic("Can't create init process!");
 
     while (!terminated) {
+        time.runTimers();
         prochost.scheduler.loopOnce();
         var init_proc = prochost.get(0);
         if (init_proc) |proc| {
@@ -132,7 +159,15 @@ pub fn main() void {
                 terminated = true;
             }
         }
-        if (kernel_flags.save_cpu) platform.waitTimer(1);
+        // Spare time goes to idle work first; only halt once there's none left.
+        if (!idle.runOnce() and kernel_flags.save_cpu) {
+            if (kernel_flags.tickless and !prochost.scheduler.hasRunnable()) {
+                var until = if (time.nextDeadline()) |deadline| deadline - time.now() else std.math.maxInt(i64);
+                platform.waitTimerNano(until);
+            } else {
+                platform.waitTimer(1);
+            }
+        }
     }
     // Should be unreachable;
     @panic("init exited!");
@@ -12,12 +12,21 @@ pub const init = impl.init;
 pub const earlyprintk = impl.earlyprintk;
 pub const halt = impl.halt;
 pub const openConsole = impl.openConsole;
+pub const setAsyncConsole = impl.setAsyncConsole;
+pub const setFramebufferConsole = impl.setFramebufferConsole;
+pub const openFramebuffer = impl.openFramebuffer;
 pub const beforeYield = impl.beforeYield;
 const late = impl.late;
 
+pub const enterCritical = impl.enterCritical;
+pub const leaveCritical = impl.leaveCritical;
+
 pub const setTimer = impl.setTimer;
 pub const waitTimer = impl.waitTimer;
+pub const waitTimerNano = impl.waitTimerNano;
 pub const getTimerInterval = impl.getTimerInterval;
+pub const readCycleCounter = impl.readCycleCounter;
+pub const cycleCounterHz = impl.cycleCounterHz;
 
 pub var internal_malloc = impl.malloc;
 pub var internal_realloc = impl.realloc;
@@ -25,6 +34,10 @@ pub var internal_free = impl.free;
 pub var getTimeNano = impl.getTimeNano;
 pub var getTime = impl.getTime;
 
+pub const page_size = impl.page_size;
+pub const allocPages = impl.allocPages;
+pub const freePages = impl.freePages;
+
 var earlyInit = true;
 
 // Should probably be in klibc
@@ -39,6 +52,30 @@ export fn free(ptr: ?[*]align(8) u8) callconv(.C) void {
     return internal_free(ptr);
 }
 
+/// General-purpose kernel heap on top of the platform allocator.
+/// Unlike the boot-time FixedBufferAllocator, memory freed here really goes back to the system.
+pub var heap_allocator = std.mem.Allocator{
+    .allocFn = heapAlloc,
+    .resizeFn = heapResize,
+};
+
+fn heapAlloc(self: *std.mem.Allocator, len: usize, ptr_align: u29, len_align: u29) std.mem.Allocator.Error![]u8 {
+    // The platform allocator only promises 8-byte alignment.
+    if (ptr_align > 8) return error.OutOfMemory;
+    var ptr = internal_malloc(len) orelse return error.OutOfMemory;
+    return ptr[0..len];
+}
+
+fn heapResize(self: *std.mem.Allocator, buf: []u8, new_len: usize, len_align: u29) std.mem.Allocator.Error!usize {
+    if (new_len == 0) {
+        internal_free(@alignCast(8, buf.ptr));
+        return 0;
+    }
+    // Shrinking is free; growing in place isn't supported, so the caller will allocate and copy.
+    if (new_len <= buf.len) return new_len;
+    return error.OutOfMemory;
+}
+
 // Useful utilities
 
 pub fn earlyprintf(comptime format: []const u8, args: anytype) void {
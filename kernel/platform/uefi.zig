@@ -10,6 +10,7 @@ pub const klibc = @import("../klibc.zig");
 pub const debugMalloc = false;
 
 const console = @import("uefi/console.zig");
+const fbcon = @import("uefi/fbcon.zig");
 
 var exitedBootServices = false;
 
@@ -17,7 +18,11 @@ const Error = error{UefiError};
 
 const timer_interval = 10000000; // Given in nanoseconds
 var timer_event: uefi.Event = undefined;
-var timer_call: ?fn () void = null;
+var timer_call: ?fn (elapsed: i64) void = null;
+var timer_period: i64 = timer_interval; // What the hardware timer is currently programmed for
+
+// Longest we'll stay tickless. The keyboard is only polled from the timer callback, so this bounds input latency.
+const max_tickless_period = 100 * time.ns_per_ms;
 var in_timer: bool = false;
 
 var timer_ticks: usize = 0;
@@ -27,8 +32,9 @@ pub fn timerCallThunk(event: uefi.Event, context: ?*const c_void) callconv(.C) v
     if (timer_ticks > 0) _ = @atomicRmw(usize, &timer_ticks, .Sub, 1, .SeqCst);
 
     console.keyboardHandler();
+    fbcon.tick();
     if (timer_call) |func| {
-        func();
+        func(timer_period);
     }
 
     _ = @atomicRmw(bool, &in_timer, .Xchg, false, .SeqCst);
@@ -79,23 +85,162 @@ pub fn free(ptr: ?[*]align(8) u8) void {
     if (status != .Success) @panic("free() failed (this shouldn't be possible)");
 }
 
+pub const page_size = 4096;
+
+pub fn allocPages(count: usize) ?[*]align(page_size) u8 {
+    var buf: [*]align(page_size) u8 = undefined;
+    var status = uefi.system_table.boot_services.?.allocatePages(.AllocateAnyPages, uefi.tables.MemoryType.BootServicesData, count, &buf);
+    if (status != .Success) return null;
+    return buf;
+}
+
+pub fn freePages(ptr: [*]align(page_size) u8, count: usize) void {
+    var status = uefi.system_table.boot_services.?.freePages(ptr, count);
+    if (status != .Success) @panic("freePages() failed (this shouldn't be possible)");
+}
+
 pub fn earlyprintk(str: []const u8) void {
-    const con_out = uefi.system_table.con_out.?;
-    for (str) |c| {
-        if (c == '\n') _ = con_out.outputString(&[_:0]u16{ '\r', 0 });
-        _ = con_out.outputString(&[_:0]u16{ c, 0 });
+    // Anything a process queued goes out first, so the two streams don't interleave out of order.
+    console.flushOutput();
+    kernel_console.write(str);
+}
+
+// Each writer gets its own decoding state, so a kernel message landing between the halves of a process's
+// multi-byte character (or "\r\n") can't mangle either of them.
+var kernel_console = ConsoleBuffer{};
+pub var process_console = ConsoleBuffer{};
+
+pub const ConsoleBuffer = struct {
+    // The firmware only speaks UCS-2, and every outputString() call is expensive, so we convert in blocks.
+    const capacity = 256;
+
+    buf: [capacity + 1]u16 = undefined, // Room for the terminator
+    len: usize = 0,
+    last: u21 = 0, // Last codepoint written, even if already flushed
+
+    // A UTF-8 sequence cut off at the end of the previous write, finished off by the next one.
+    utf8_partial: [4]u8 = undefined,
+    utf8_partial_len: usize = 0,
+
+    fn put(self: *ConsoleBuffer, char: u16) void {
+        if (self.len == ConsoleBuffer.capacity) self.flush();
+        self.buf[self.len] = char;
+        self.len += 1;
+    }
+
+    fn putCodepoint(self: *ConsoleBuffer, codepoint: u21) void {
+        // The firmware wants "\r\n"; don't double up the \r if we already got one.
+        if (codepoint == '\n' and self.last != '\r') self.put('\r');
+        self.last = codepoint;
+        // Nothing outside the BMP survives UCS-2.
+        self.put(if (codepoint > 0xFFFF or (codepoint >= 0xD800 and codepoint <= 0xDFFF)) 0xFFFD else @intCast(u16, codepoint));
+    }
+
+    fn flush(self: *ConsoleBuffer) void {
+        if (self.len == 0) return;
+        if (fbcon.active) {
+            fbcon.write(self.buf[0..self.len]);
+        } else {
+            self.buf[self.len] = 0;
+            _ = uefi.system_table.con_out.?.outputString(@ptrCast([*:0]const u16, &self.buf[0]));
+        }
+        self.len = 0;
     }
+
+    /// Write UTF-8 straight to the firmware console, bypassing the output ring.
+    pub fn write(self: *ConsoleBuffer, str: []const u8) void {
+        defer self.flush();
+
+        var rest = str;
+        if (self.utf8_partial_len > 0) {
+            var want = std.unicode.utf8ByteSequenceLength(self.utf8_partial[0]) catch unreachable;
+            while (self.utf8_partial_len < want and rest.len > 0 and rest[0] & 0xC0 == 0x80) {
+                self.utf8_partial[self.utf8_partial_len] = rest[0];
+                self.utf8_partial_len += 1;
+                rest = rest[1..];
+            }
+            if (self.utf8_partial_len < want and rest.len == 0) return; // Still not complete; wait for more
+
+            if (self.utf8_partial_len < want) {
+                self.putCodepoint(0xFFFD); // Cut short by something that isn't a continuation byte
+            } else {
+                self.putCodepoint(std.unicode.utf8Decode(self.utf8_partial[0..want]) catch 0xFFFD);
+            }
+            self.utf8_partial_len = 0;
+        }
+
+        var i: usize = 0;
+        while (i < rest.len) {
+            var byte = rest[i];
+            if (byte < 0x80) {
+                self.putCodepoint(byte);
+                i += 1;
+                continue;
+            }
+
+            var len = std.unicode.utf8ByteSequenceLength(byte) catch {
+                self.putCodepoint(0xFFFD);
+                i += 1;
+                continue;
+            };
+            if (i + len > rest.len) {
+                std.mem.copy(u8, self.utf8_partial[0..], rest[i..]);
+                self.utf8_partial_len = rest.len - i;
+                break;
+            }
+
+            if (std.unicode.utf8Decode(rest[i .. i + len])) |codepoint| {
+                self.putCodepoint(codepoint);
+                i += len;
+            } else |_| {
+                // Resynchronise on the next byte rather than swallowing what might be the start of a valid sequence.
+                self.putCodepoint(0xFFFD);
+                i += 1;
+            }
+        }
+    }
+};
+
+pub fn setAsyncConsole(enabled: bool) void {
+    if (!enabled) console.flushOutput();
+    console.async_output = enabled;
 }
 
 pub fn openConsole() vfs.Node {
     return console.ConsoleNode.init();
 }
 
+/// Draw the console ourselves through GOP instead of going through the firmware's text output.
+/// Returns whether the framebuffer console is in use afterwards.
+pub fn setFramebufferConsole(enabled: bool) bool {
+    if (!enabled) {
+        fbcon.flush();
+        fbcon.active = false;
+        return false;
+    }
+    return fbcon.active or fbcon.init();
+}
+
+/// Raw access to the framebuffer; only available while the framebuffer console is.
+pub fn openFramebuffer() ?vfs.Node {
+    if (!fbcon.active) return null;
+    return fbcon.FramebufferNode.init();
+}
+
 pub fn beforeYield() void {
     _ = @atomicRmw(bool, &in_timer, .Xchg, false, .SeqCst);
     uefi.system_table.boot_services.?.restoreTpl(uefi.tables.BootServices.tpl_application);
 }
 
+/// Keep the timer callback (and with it the keyboard handler) from running until `leaveCritical`.
+pub fn enterCritical() usize {
+    return uefi.system_table.boot_services.?.raiseTpl(uefi.tables.BootServices.tpl_notify);
+}
+
+pub fn leaveCritical(old: usize) void {
+    uefi.system_table.boot_services.?.restoreTpl(old);
+}
+
 pub fn setTimer(cb: @TypeOf(timer_call)) void {
     timer_call = cb;
 }
@@ -106,6 +251,78 @@ pub fn waitTimer(ticks: usize) void {
     while (timer_ticks > 0) asm volatile ("hlt");
 }
 
+/// Halt for up to `max_ns` nanoseconds. Longer than one timer interval, the periodic timer is swapped for a single
+/// one-shot so that the CPU isn't woken every tick for nothing.
+pub fn waitTimerNano(max_ns: i64) void {
+    if (max_ns <= timer_interval) return waitTimer(1);
+
+    var boot_services = uefi.system_table.boot_services.?;
+    var period = std.math.min(max_ns, max_tickless_period);
+
+    // Don't leave the last thing written sitting in the shadow buffer while we sleep.
+    fbcon.flush();
+
+    // The callback reports `timer_period` as elapsed time, so it mustn't run between these two.
+    var old_tpl = enterCritical();
+    timer_period = period;
+    _ = boot_services.setTimer(timer_event, uefi.tables.TimerDelay.TimerRelative, @intCast(u64, @divFloor(period, 100)));
+    leaveCritical(old_tpl);
+
+    waitTimer(1);
+
+    old_tpl = enterCritical();
+    timer_period = timer_interval;
+    _ = boot_services.setTimer(timer_event, uefi.tables.TimerDelay.TimerPeriodic, timer_interval / 100);
+    leaveCritical(old_tpl);
+}
+
+pub fn readCycleCounter() u64 {
+    if (builtin.arch != .x86_64) return 0;
+
+    var low: u32 = undefined;
+    var high: u32 = undefined;
+    asm volatile ("rdtsc"
+        : [low] "={eax}" (low),
+          [high] "={edx}" (high)
+    );
+    return (@as(u64, high) << 32) | low;
+}
+
+const CpuidResult = struct { eax: u32, ebx: u32, ecx: u32, edx: u32 };
+
+fn cpuid(leaf: u32) CpuidResult {
+    var ret: CpuidResult = undefined;
+    asm volatile ("cpuid"
+        : [eax] "={eax}" (ret.eax),
+          [ebx] "={ebx}" (ret.ebx),
+          [ecx] "={ecx}" (ret.ecx),
+          [edx] "={edx}" (ret.edx)
+        : [leaf] "{eax}" (leaf),
+          [subleaf] "{ecx}" (@as(u32, 0))
+    );
+    return ret;
+}
+
+/// Frequency of `readCycleCounter`, measured against the firmware's stall(). Null if the counter
+/// can't be used as a clock (i.e. the TSC isn't invariant and may change speed or stop in idle).
+pub fn cycleCounterHz() ?u64 {
+    if (builtin.arch != .x86_64) return null;
+
+    if (cpuid(0x80000000).eax < 0x80000007) return null;
+    if (cpuid(0x80000007).edx & (1 << 8) == 0) return null;
+
+    // stall() only promises to wait *at least* as long as asked, so the shortest of a few runs is the most accurate.
+    const stall_us = 10000;
+    var best: u64 = std.math.maxInt(u64);
+    var round: usize = 0;
+    while (round < 3) : (round += 1) {
+        var start = readCycleCounter();
+        _ = uefi.system_table.boot_services.?.stall(stall_us);
+        best = std.math.min(best, readCycleCounter() - start);
+    }
+    return best * (time.us_per_s / stall_us);
+}
+
 pub fn getTimerInterval() i64 {
     return timer_interval;
 }
@@ -165,6 +382,7 @@ pub fn late() void {
 }
 
 pub fn halt() noreturn {
+    fbcon.flush();
     if (!exitedBootServices) while (true) {
         _ = uefi.system_table.boot_services.?.stall(0x7FFFFFFF);
     };
@@ -2,6 +2,8 @@ const std = @import("std");
 const uefi = std.os.uefi;
 const uefi_platform = @import("../uefi.zig");
 const vfs = @import("../../vfs.zig");
+const task = @import("../../task.zig");
+const idle = @import("../../idle.zig");
 
 const Node = vfs.Node;
 
@@ -11,8 +13,59 @@ var console_fifo = std.fifo.LinearFifo(u8, .Slice).init(console_scratch[0..]);
 var keyboard_scratch: [8192]u8 = undefined;
 var keyboard_fifo = std.fifo.LinearFifo(u8, .Slice).init(keyboard_scratch[0..]);
 
+// Tasks waiting for console or keyboard input. Woken from the keyboard handler, in interrupt context.
+var console_waiters: task.WaitQueue = .{};
+var keyboard_waiters: task.WaitQueue = .{};
+
 pub var text_in_ex: ?*uefi.protocols.SimpleTextInputExProtocol = null;
 
+/// Queue process output and write it to the firmware from idle time, instead of making the writer wait for it.
+pub var async_output = false;
+
+var output_scratch: [16384]u8 = undefined;
+var output_fifo = std.fifo.LinearFifo(u8, .Slice).init(output_scratch[0..]);
+var output_work = idle.Work.init(flushOutputStep, null);
+
+// Most we hand to the firmware per idle turn, so a big write doesn't hog the idle loop.
+const output_flush_chunk = 1024;
+
+fn queueOutput(bytes: []const u8) void {
+    var rest = bytes;
+    while (rest.len > 0) {
+        // Full: the writer has to wait after all.
+        if (output_fifo.writableLength() == 0) flushOutput();
+
+        var amount = std.math.min(rest.len, output_fifo.writableLength());
+        output_fifo.writeAssumeCapacity(rest[0..amount]);
+        rest = rest[amount..];
+    }
+    idle.schedule(&output_work);
+}
+
+fn flushOutputStep(work: *idle.Work) bool {
+    var chunk = output_fifo.readableSlice(0);
+    chunk = chunk[0..std.math.min(chunk.len, output_flush_chunk)];
+    uefi_platform.process_console.write(chunk);
+    output_fifo.discard(chunk.len);
+    return output_fifo.readableLength() > 0;
+}
+
+/// Write out everything queued so far.
+pub fn flushOutput() void {
+    while (output_fifo.readableLength() > 0) {
+        var chunk = output_fifo.readableSlice(0);
+        uefi_platform.process_console.write(chunk);
+        output_fifo.discard(chunk.len);
+    }
+    idle.cancel(&output_work);
+}
+
+// Synchronous process output: anything queued before goes first.
+fn writeOutput(bytes: []const u8) void {
+    flushOutput();
+    uefi_platform.process_console.write(bytes);
+}
+
 pub fn init() void {
     if (uefi.system_table.boot_services.?.locateProtocol(&uefi.protocols.SimpleTextInputExProtocol.guid, null, @ptrCast(*?*c_void, &text_in_ex)) == uefi.Status.Success) {
         uefi_platform.earlyprintk("Extended text input supported.\n");
@@ -35,6 +88,7 @@ fn basicKeyboardHandler() void {
     _ = std.unicode.utf16leToUtf8(outbuf[0..], inbuf[0..]) catch unreachable;
 
     _ = console_fifo.write(outbuf[0..]) catch null;
+    console_waiters.wakeAll();
 }
 
 fn extendedKeyboardHandler() void {
@@ -51,29 +105,72 @@ fn extendedKeyboardHandler() void {
     _ = console_fifo.write(outbuf[0..]) catch null;
 
     _ = keyboard_fifo.write(std.mem.asBytes(&keydata)) catch null;
+    console_waiters.wakeAll();
+    keyboard_waiters.wakeAll();
 }
 
 pub const ConsoleNode = struct {
     const ops: Node.Ops = .{
         .read = ConsoleNode.read,
         .write = ConsoleNode.write,
+        .writev = ConsoleNode.writev,
+        .poll = ConsoleNode.poll,
     };
 
     pub fn init() Node {
-        return Node.init(ConsoleNode.ops, null, Node.Stat{ .type = .character_device, .device_info = .{ .class = .console, .name = "uefi_console" } }, null);
+        var node = Node.init(ConsoleNode.ops, null, Node.Stat{ .type = .character_device, .device_info = .{ .class = .console, .name = "uefi_console" } }, null);
+        node.wait_queue = &console_waiters;
+        return node;
+    }
+
+    pub fn poll(self: *Node, events: Node.PollEvents) Node.PollEvents {
+        return .{ .read = events.read and console_fifo.readableLength() > 0, .write = events.write };
     }
 
     pub fn write(self: *Node, offset: u64, buffer: []const u8) !usize {
-        uefi_platform.earlyprintk(buffer);
+        if (async_output) queueOutput(buffer) else writeOutput(buffer);
         return buffer.len;
     }
 
+    // Glue the pieces together so that a libc writev() (e.g. "prefix" + "message" + "\n") reaches the firmware in one go.
+    pub fn writev(self: *Node, offset: u64, buffers: []const []const u8) !usize {
+        if (async_output) {
+            var total: usize = 0;
+            for (buffers) |buffer| {
+                queueOutput(buffer);
+                total += buffer.len;
+            }
+            return total;
+        }
+
+        var scratch: [1024]u8 = undefined;
+        var used: usize = 0;
+        var total: usize = 0;
+
+        for (buffers) |buffer| {
+            var rest = buffer;
+            while (rest.len > 0) {
+                if (used == scratch.len) {
+                    writeOutput(scratch[0..used]);
+                    used = 0;
+                }
+                var amount = std.math.min(rest.len, scratch.len - used);
+                std.mem.copy(u8, scratch[used..], rest[0..amount]);
+                used += amount;
+                rest = rest[amount..];
+            }
+            total += buffer.len;
+        }
+        if (used > 0) writeOutput(scratch[0..used]);
+        return total;
+    }
+
     pub fn read(self: *Node, offset: u64, buffer: []u8) !usize {
         var n = console_fifo.read(buffer);
         for (buffer[0..n]) |c, i| {
             if (c == '\r') buffer[i] = '\n';
         }
-        uefi_platform.earlyprintk(buffer[0..n]);
+        writeOutput(buffer[0..n]);
         return if (n == 0) vfs.Error.Again else n;
     }
 };
@@ -81,10 +178,17 @@ pub const ConsoleNode = struct {
 pub const KeyboardNode = struct {
     const ops: Node.Ops = .{
         .read = KeyboardNode.read,
+        .poll = KeyboardNode.poll,
     };
 
     pub fn init() Node {
-        return Node.init(KeyboardNode.ops, null, Node.Stat{ .type = character_device, .device_info = .{ .class = .keyboard, .name = "uefi_keyboard" } }, null);
+        var node = Node.init(KeyboardNode.ops, null, Node.Stat{ .type = .character_device, .device_info = .{ .class = .keyboard, .name = "uefi_keyboard" } }, null);
+        node.wait_queue = &keyboard_waiters;
+        return node;
+    }
+
+    pub fn poll(self: *Node, events: Node.PollEvents) Node.PollEvents {
+        return .{ .read = events.read and keyboard_fifo.readableLength() >= @sizeOf(uefi.protocols.KeyData) };
     }
 
     pub fn read(self: *Node, offset: u64, buffer: []u8) !usize {
@@ -0,0 +1,368 @@
+// Framebuffer console on top of the Graphics Output Protocol.
+// Everything is drawn into a shadow buffer in RAM: reading video memory back is painfully slow, and poking it a glyph
+// at a time isn't much better. The timer tick copies out whatever changed since the last one, a bounded amount
+// at a time, since it runs at TPL_NOTIFY with the keyboard and everything else waiting behind it.
+
+const std = @import("std");
+const uefi = std.os.uefi;
+const uefi_platform = @import("../uefi.zig");
+const vfs = @import("../../vfs.zig");
+const font = @import("font8x8.zig");
+
+const Node = vfs.Node;
+const GraphicsOutputProtocol = uefi.protocols.GraphicsOutputProtocol;
+
+// The font is 8x8; doubling every row gives the usual 8x16 text cell.
+const cell_width = font.width;
+const cell_height = font.height * 2;
+const cell_pixels = cell_width * cell_height;
+
+const glyph_count = font.last_char - font.first_char + 2; // Plus the replacement glyph
+const replacement_index = glyph_count - 1;
+
+const tab_width = 8;
+
+// Most we copy to video memory per timer tick. A full-screen redraw (e.g. scrolling) spreads over a few ticks.
+const flush_bytes_per_tick = 256 * 1024;
+
+pub const Color = struct { r: u8, g: u8, b: u8 };
+
+const default_fg = Color{ .r = 0xAA, .g = 0xAA, .b = 0xAA };
+const default_bg = Color{ .r = 0x00, .g = 0x00, .b = 0x00 };
+
+const splash_pcx = @embedFile("../../../res/boot_1.pcx");
+
+const Rect = struct {
+    // x1 and y1 are exclusive.
+    x0: usize = 0,
+    y0: usize = 0,
+    x1: usize = 0,
+    y1: usize = 0,
+
+    fn isEmpty(self: Rect) bool {
+        return self.x0 >= self.x1 or self.y0 >= self.y1;
+    }
+
+    fn add(self: *Rect, x0: usize, y0: usize, x1: usize, y1: usize) void {
+        if (self.isEmpty()) {
+            self.* = .{ .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y1 };
+            return;
+        }
+        self.x0 = std.math.min(self.x0, x0);
+        self.y0 = std.math.min(self.y0, y0);
+        self.x1 = std.math.max(self.x1, x1);
+        self.y1 = std.math.max(self.y1, y1);
+    }
+};
+
+pub var active = false;
+
+var framebuffer: [*]u32 = undefined;
+var stride: usize = 0; // In pixels; may be wider than the visible width
+var width: usize = 0;
+var height: usize = 0;
+var red_first = false; // PixelRedGreenBlueReserved8BitPerColor rather than the usual BGR
+
+var shadow: []u32 = &[_]u32{};
+var dirty: Rect = .{};
+
+var cols: usize = 0;
+var rows: usize = 0;
+var text_top: usize = 0; // First pixel row of the text area, below the splash
+var cursor_x: usize = 0;
+var cursor_y: usize = 0;
+
+var fg_pixel: u32 = 0;
+var bg_pixel: u32 = 0;
+
+// Every glyph expanded to native pixels the first time it's drawn, so drawing a cell is a handful of row copies.
+var glyph_cache: []u32 = &[_]u32{};
+var glyph_cached = [_]bool{false} ** glyph_count;
+
+fn pixelOf(color: Color) u32 {
+    if (red_first) return @as(u32, color.r) | (@as(u32, color.g) << 8) | (@as(u32, color.b) << 16);
+    return @as(u32, color.b) | (@as(u32, color.g) << 8) | (@as(u32, color.r) << 16);
+}
+
+fn pagesFor(count: usize) usize {
+    return (count * @sizeOf(u32) + uefi_platform.page_size - 1) / uefi_platform.page_size;
+}
+
+fn allocPixels(count: usize) ?[]u32 {
+    var pages = uefi_platform.allocPages(pagesFor(count)) orelse return null;
+    return @ptrCast([*]u32, pages)[0..count];
+}
+
+fn freePixels(pixels: []u32) void {
+    uefi_platform.freePages(@ptrCast([*]align(uefi_platform.page_size) u8, @alignCast(uefi_platform.page_size, pixels.ptr)), pagesFor(pixels.len));
+}
+
+/// Take over the screen. Returns false if there's no usable framebuffer, in which case the firmware console stays.
+pub fn init() bool {
+    var gop: ?*GraphicsOutputProtocol = null;
+    if (uefi.system_table.boot_services.?.locateProtocol(&GraphicsOutputProtocol.guid, null, @ptrCast(*?*c_void, &gop)) != uefi.Status.Success) return false;
+
+    var mode = gop.?.mode;
+    var info = mode.info;
+    switch (info.pixel_format) {
+        .PixelRedGreenBlueReserved8BitPerColor => red_first = true,
+        .PixelBlueGreenRedReserved8BitPerColor => red_first = false,
+        // Bitmask formats are rare enough not to bother, and BltOnly has no framebuffer at all.
+        else => return false,
+    }
+
+    width = info.horizontal_resolution;
+    height = info.vertical_resolution;
+    stride = info.pixels_per_scan_line;
+    framebuffer = @intToPtr([*]u32, @intCast(usize, mode.frame_buffer_base));
+    if (width < cell_width or height < cell_height) return false;
+
+    shadow = allocPixels(width * height) orelse return false;
+    glyph_cache = allocPixels(glyph_count * cell_pixels) orelse {
+        freePixels(shadow);
+        return false;
+    };
+
+    fg_pixel = pixelOf(default_fg);
+    bg_pixel = pixelOf(default_bg);
+    std.mem.set(u32, shadow, bg_pixel);
+
+    text_top = 0;
+    if (drawSplash(splash_pcx)) |splash_height| {
+        // Leave a blank line between the splash and the first line of text.
+        text_top = std.mem.alignForward(splash_height, cell_height) + cell_height;
+    } else |_| {}
+
+    cols = width / cell_width;
+    rows = (height - std.math.min(text_top, height)) / cell_height;
+    if (rows == 0) {
+        text_top = 0;
+        rows = height / cell_height;
+        std.mem.set(u32, shadow, bg_pixel);
+    }
+    cursor_x = 0;
+    cursor_y = 0;
+
+    dirty.add(0, 0, width, height);
+    active = true;
+    flush();
+    return true;
+}
+
+fn glyphPixels(index: usize) []const u32 {
+    var pixels = glyph_cache[index * cell_pixels .. (index + 1) * cell_pixels];
+    if (glyph_cached[index]) return pixels;
+
+    var bitmap = if (index == replacement_index) &font.replacement else &font.glyphs[index];
+    for (bitmap) |bits, row| {
+        var line = pixels[row * 2 * cell_width .. (row * 2 + 1) * cell_width];
+        for (line) |*pixel, col| {
+            pixel.* = if (bits & (@as(u8, 1) << @intCast(u3, col)) != 0) fg_pixel else bg_pixel;
+        }
+        std.mem.copy(u32, pixels[(row * 2 + 1) * cell_width .. (row * 2 + 2) * cell_width], line);
+    }
+    glyph_cached[index] = true;
+    return pixels;
+}
+
+fn drawCell(col: usize, row: usize, index: usize) void {
+    var pixels = glyphPixels(index);
+    var x = col * cell_width;
+    var y = text_top + row * cell_height;
+
+    var line: usize = 0;
+    while (line < cell_height) : (line += 1) {
+        var start = (y + line) * width + x;
+        std.mem.copy(u32, shadow[start .. start + cell_width], pixels[line * cell_width .. (line + 1) * cell_width]);
+    }
+    dirty.add(x, y, x + cell_width, y + cell_height);
+}
+
+fn scroll() void {
+    var line_pixels = cell_height * width;
+    var area = shadow[text_top * width .. (text_top + rows * cell_height) * width];
+
+    // Overlapping, but moving towards lower addresses, which is what copy() handles.
+    std.mem.copy(u32, area[0 .. area.len - line_pixels], area[line_pixels..]);
+    std.mem.set(u32, area[area.len - line_pixels ..], bg_pixel);
+    dirty.add(0, text_top, width, text_top + rows * cell_height);
+}
+
+fn lineFeed() void {
+    if (cursor_y + 1 < rows) {
+        cursor_y += 1;
+    } else {
+        scroll();
+    }
+}
+
+fn putChar(char: u16) void {
+    switch (char) {
+        '\r' => cursor_x = 0,
+        '\n' => lineFeed(),
+        0x08 => {
+            if (cursor_x > 0) cursor_x -= 1;
+        },
+        '\t' => {
+            cursor_x = std.math.min(cols - 1, (cursor_x / tab_width + 1) * tab_width);
+        },
+        else => {
+            if (char < font.first_char) return; // Other control characters draw nothing
+            if (cursor_x == cols) {
+                cursor_x = 0;
+                lineFeed();
+            }
+            var index = if (char <= font.last_char) char - font.first_char else replacement_index;
+            drawCell(cursor_x, cursor_y, index);
+            cursor_x += 1;
+        },
+    }
+}
+
+/// Draw UCS-2 text (with the firmware's \r\n line endings) at the cursor. It reaches the screen on the next flush.
+pub fn write(chars: []const u16) void {
+    var old_tpl = uefi_platform.enterCritical();
+    defer uefi_platform.leaveCritical(old_tpl);
+
+    for (chars) |char| putChar(char);
+}
+
+/// Copy everything drawn since the last flush out to video memory.
+pub fn flush() void {
+    flushBytes(std.math.maxInt(usize));
+}
+
+/// Copy out some of what was drawn since the last flush. Called from the timer tick.
+pub fn tick() void {
+    flushBytes(flush_bytes_per_tick);
+}
+
+// Copy the dirty rectangle out top to bottom, stopping after whole rows worth about `budget` bytes.
+fn flushBytes(budget: usize) void {
+    if (!active) return;
+
+    var old_tpl = uefi_platform.enterCritical();
+    defer uefi_platform.leaveCritical(old_tpl);
+
+    if (dirty.isEmpty()) return;
+    var row_bytes = (dirty.x1 - dirty.x0) * @sizeOf(u32);
+    var max_rows = std.math.max(1, budget / row_bytes);
+
+    var y = dirty.y0;
+    while (y < dirty.y1 and y - dirty.y0 < max_rows) : (y += 1) {
+        std.mem.copy(u32, framebuffer[y * stride + dirty.x0 .. y * stride + dirty.x1], shadow[y * width + dirty.x0 .. y * width + dirty.x1]);
+    }
+    dirty.y0 = y;
+    if (dirty.isEmpty()) dirty = .{};
+}
+
+const PcxError = error{InvalidImage};
+
+/// Decode a PCX image (8 bits per plane, either 3 planes of RGB or 1 plane with a 256-color palette) and draw it
+/// centered at the top of the screen. Returns its height in pixels.
+fn drawSplash(data: []const u8) PcxError!usize {
+    const header_size = 128;
+    if (data.len < header_size or data[0] != 0x0A or data[2] != 1 or data[3] != 8) return PcxError.InvalidImage;
+
+    var x_min = std.mem.readIntLittle(u16, data[4..6]);
+    var y_min = std.mem.readIntLittle(u16, data[6..8]);
+    var x_max = std.mem.readIntLittle(u16, data[8..10]);
+    var y_max = std.mem.readIntLittle(u16, data[10..12]);
+    var planes: usize = data[65];
+    var bytes_per_line: usize = std.mem.readIntLittle(u16, data[66..68]);
+    if (x_max < x_min or y_max < y_min) return PcxError.InvalidImage;
+
+    var image_width = @as(usize, x_max - x_min) + 1;
+    var image_height = @as(usize, y_max - y_min) + 1;
+    if (bytes_per_line < image_width or image_width > width or cell_height + image_height > height) return PcxError.InvalidImage;
+
+    var palette: []const u8 = undefined;
+    var end = data.len;
+    switch (planes) {
+        3 => {},
+        1 => {
+            // The palette trails the image data, introduced by a 0x0C byte.
+            if (data.len < header_size + 769 or data[data.len - 769] != 0x0C) return PcxError.InvalidImage;
+            palette = data[data.len - 768 ..];
+            end = data.len - 769;
+        },
+        else => return PcxError.InvalidImage,
+    }
+
+    var scanline: [3 * 1024]u8 = undefined;
+    var line_len = planes * bytes_per_line;
+    if (line_len > scanline.len) return PcxError.InvalidImage;
+
+    var left = (width - image_width) / 2;
+    var top: usize = cell_height;
+    var pos: usize = header_size;
+
+    var y: usize = 0;
+    while (y < image_height) : (y += 1) {
+        // Runs are allowed to straddle planes, so decode the whole scanline before looking at it.
+        var filled: usize = 0;
+        while (filled < line_len) {
+            if (pos >= end) return PcxError.InvalidImage;
+            var byte = data[pos];
+            pos += 1;
+
+            var count: usize = 1;
+            if (byte & 0xC0 == 0xC0) {
+                if (pos >= end) return PcxError.InvalidImage;
+                count = byte & 0x3F;
+                byte = data[pos];
+                pos += 1;
+            }
+            count = std.math.min(count, line_len - filled);
+            std.mem.set(u8, scanline[filled .. filled + count], byte);
+            filled += count;
+        }
+
+        var row = shadow[(top + y) * width + left .. (top + y) * width + left + image_width];
+        for (row) |*pixel, x| {
+            pixel.* = if (planes == 3)
+                pixelOf(.{ .r = scanline[x], .g = scanline[bytes_per_line + x], .b = scanline[2 * bytes_per_line + x] })
+            else
+                pixelOf(.{ .r = palette[@as(usize, scanline[x]) * 3], .g = palette[@as(usize, scanline[x]) * 3 + 1], .b = palette[@as(usize, scanline[x]) * 3 + 2] });
+        }
+    }
+    return top + image_height;
+}
+
+/// The framebuffer as a flat array of 32-bit pixels, `width` to a row. Writes show up on the next tick.
+pub const FramebufferNode = struct {
+    const ops: Node.Ops = .{
+        .read = FramebufferNode.read,
+        .write = FramebufferNode.write,
+    };
+
+    pub fn init() Node {
+        var size = shadow.len * @sizeOf(u32);
+        return Node.init(FramebufferNode.ops, null, Node.Stat{ .type = .block_device, .size = size, .block_size = width * @sizeOf(u32), .device_info = .{ .class = .framebuffer, .name = "uefi_gop" } }, null);
+    }
+
+    pub fn read(self: *Node, offset: u64, buffer: []u8) !usize {
+        var bytes = std.mem.sliceAsBytes(shadow);
+        if (offset >= bytes.len) return 0;
+        var start = @intCast(usize, offset);
+        var end = std.math.min(bytes.len, start + buffer.len);
+        std.mem.copy(u8, buffer, bytes[start..end]);
+        return end - start;
+    }
+
+    pub fn write(self: *Node, offset: u64, buffer: []const u8) !usize {
+        if (buffer.len == 0) return 0;
+        var bytes = std.mem.sliceAsBytes(shadow);
+        if (offset >= bytes.len) return vfs.Error.NoSpace;
+        var start = @intCast(usize, offset);
+        var end = std.math.min(bytes.len, start + buffer.len);
+
+        var old_tpl = uefi_platform.enterCritical();
+        defer uefi_platform.leaveCritical(old_tpl);
+
+        std.mem.copy(u8, bytes[start..end], buffer[0 .. end - start]);
+        var row_bytes = width * @sizeOf(u32);
+        dirty.add(0, start / row_bytes, width, (end - 1) / row_bytes + 1);
+        return end - start;
+    }
+};
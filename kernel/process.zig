@@ -6,7 +6,7 @@ const task = @import("task.zig");
 
 const wasm_rt = @import("runtime/wasm.zig");
 
-const Error = error{NotImplemented, NotCapable};
+const Error = error{NotImplemented, NotCapable, NotSeekable, InvalidOffset, TooManyOpenFiles};
 
 pub const RuntimeType = enum {
     wasm,
@@ -27,6 +27,14 @@ pub const Runtime = union(RuntimeType) {
         }
     }
 
+    fn onResume(self: *Runtime) void {
+        switch (self.*) {
+            .wasm => self.wasm.publishClock(),
+            .native => unreachable,
+            else => unreachable,
+        }
+    }
+
     fn deinit(self: *Runtime) void {
         switch (self.*) {
             .wasm => self.wasm.deinit(),
@@ -53,53 +61,59 @@ pub const Fd = struct {
     pub const max_num: Fd.Num = 65536;
 
     pub const Flags = struct {
+        append: bool = false, // Every write() goes to the end of the file, wherever the seek pointer was
         sync: bool = false,
         nonblock: bool = false,
     };
 
+    // Bit order (LSB first) matches WASI's oflags, so the guest's value can be used as-is.
     pub const OpenFlags = extern union {
         Flags: packed struct {
-            truncate: bool = false,
-            exclusive: bool = false,
-            directory: bool = false,
             create: bool = false,
+            directory: bool = false,
+            exclusive: bool = false,
+            truncate: bool = false,
         },
         Int: u16,
     };
 
+    // Bit order (LSB first) matches WASI's rights, so the guest's value can be used as-is.
     pub const Rights = extern union {
         Flags: packed struct {
-            sock_shutdown: bool = true,
-            poll_fd_readwrite: bool = true,
-            path_unlink_file: bool = true,
-            path_remove_directory: bool = true,
-            path_symlink: bool = true,
-            fd_filestat_set_times: bool = true,
-            fd_filestat_set_size: bool = true,
-            fd_filestat_get: bool = true,
-            path_filestat_set_times: bool = true,
-            path_filestat_set_size: bool = true,
-            path_filestat_get: bool = true,
-            path_rename_target: bool = true,
-            path_rename_source: bool = true,
-            path_readlink: bool = true,
-            fd_readdir: bool = true,
-            path_open: bool = true,
-            path_link_target: bool = true,
-            path_link_source: bool = true,
-            path_create_file: bool = true,
-            path_create_directory: bool = true,
-            fd_allocate: bool = true,
-            fd_advise: bool = true,
-            fd_write: bool = true,
-            fd_tell: bool = true,
-            fd_sync: bool = true,
-            fd_fdstat_set_flags: bool = true,
-            fd_seek: bool = true,
-            fd_read: bool = true,
             fd_datasync: bool = true,
+            fd_read: bool = true,
+            fd_seek: bool = true,
+            fd_fdstat_set_flags: bool = true,
+            fd_sync: bool = true,
+            fd_tell: bool = true,
+            fd_write: bool = true,
+            fd_advise: bool = true,
+            fd_allocate: bool = true,
+            path_create_directory: bool = true,
+            path_create_file: bool = true,
+            path_link_source: bool = true,
+            path_link_target: bool = true,
+            path_open: bool = true,
+            fd_readdir: bool = true,
+            path_readlink: bool = true,
+            path_rename_source: bool = true,
+            path_rename_target: bool = true,
+            path_filestat_get: bool = true,
+            path_filestat_set_size: bool = true,
+            path_filestat_set_times: bool = true,
+            fd_filestat_get: bool = true,
+            fd_filestat_set_size: bool = true,
+            fd_filestat_set_times: bool = true,
+            path_symlink: bool = true,
+            path_remove_directory: bool = true,
+            path_unlink_file: bool = true,
+            poll_fd_readwrite: bool = true,
+            sock_shutdown: bool = true,
         },
         Int: u64,
+
+        /// Bits that mean something; only these survive inheritance.
+        pub const valid_mask: u64 = (1 << @bitSizeOf(std.meta.fieldInfo(Rights, "Flags").field_type)) - 1;
     };
 
     num: Fd.Num,
@@ -121,89 +135,205 @@ pub const Fd = struct {
         }
     }
  
-    pub fn open(self: *Fd, path: []const u8, oflags: Fd.OpenFlags, rights_base: Fd.Rights, inheriting_rights: Fd.Rights, fdflags: Fd.Flags, mode: vfs.FileMode) !*Fd {
+    pub fn open(self: *Fd, path: []const u8, oflags: Fd.OpenFlags, rights_base: Fd.Rights, inheriting_rights: Fd.Rights, fdflags: Fd.Flags, mode: vfs.Node.Mode) !*Fd {
         try self.checkRights(.{"path_open"});
+        var proc = self.proc.?;
+
+        var node: *vfs.Node = undefined;
+        if (self.node.findRecursive(path)) |file| {
+            node = file.node;
+            errdefer node.close() catch {};
+
+            if (oflags.Flags.create and oflags.Flags.exclusive) return vfs.Error.FileExists;
+            if (oflags.Flags.directory and node.stat.type != .directory) return vfs.Error.NotDirectory;
+        } else |err| {
+            if (!oflags.Flags.create or err != vfs.Error.NoSuchFile) return err;
+            if (oflags.Flags.directory) try self.checkRights(.{"path_create_directory"}) else try self.checkRights(.{"path_create_file"});
+
+            var parent = try self.node.findRecursive(vfs.dirname(path));
+            defer parent.node.close() catch {};
+            node = (try parent.node.create(vfs.basename(path), if (oflags.Flags.directory) .directory else .file, mode)).node;
+        }
+        errdefer node.close() catch {};
+
+        if (oflags.Flags.truncate and node.stat.type == .file and node.stat.size > 0) {
+            try self.checkRights(.{"path_filestat_set_size"});
+            try node.truncate(0);
+        }
 
-        var ret_node: ?*Node = self.node.findRecursive(path) catch |err| {
-            if (!oflags.Flags.create || err != vfs.NoSuchFile) return err;
-            ret_node = null;
+        var fd_num: Fd.Num = 0;
+        while (proc.open_nodes.contains(fd_num)) {
+            fd_num += 1;
+            if (fd_num == Fd.max_num) return Error.TooManyOpenFiles;
+        }
+
+        var new_fd = try proc.allocator.create(Fd);
+        errdefer proc.allocator.destroy(new_fd);
+
+        // A new fd can never have more rights than its directory lets it inherit.
+        var inheritable = self.inheriting_rights.Int & Fd.Rights.valid_mask;
+        new_fd.* = .{
+            .proc = proc,
+            .num = fd_num,
+            .node = node,
+            .flags = fdflags,
+            .open_flags = oflags,
+            .rights = .{ .Int = rights_base.Int & inheritable },
+            .inheriting_rights = .{ .Int = inheriting_rights.Int & inheritable },
         };
-        errdefer if (ret_node != null) ret_node.?.close();
-
-        if (ret_node) |ret_node_tmp| {
-           if (oflags.Flags.exclusive) return vfs.FileExists;
-           if (oflags.Flags.directory && ret_node_tmp.stat.type != .directory) return vfs.NotDirectory;
-        } else if (oflags.Flags.create) {
-           var parent_dir = vfs.dirname(path);
-           var parent_node: *Node = if (parent_dir.len == 0) self.node else try self.node.findRecursive(parent_dir);
-           ret_node = try parent_node.create(vfs.basename(path), if (oflags.Flags.directory) .directory else .file, mode);
-        } else {
-           unreachable;
+        try proc.open_nodes.putNoClobber(fd_num, new_fd);
+
+        return new_fd;
+    }
+
+    /// List directory entries starting at `cookie` (0 for the beginning, otherwise a `dir_cookie` from an earlier call).
+    pub fn readDir(self: *Fd, cookie: u64, files: []vfs.File) !usize {
+        try self.checkRights(.{"fd_readdir"});
+        self.proc.?.task().yield();
+        return try self.node.readDir(cookie, files);
+    }
+
+    pub fn write(self: *Fd, buffer: []const u8) !usize {
+        return try self.writev(&[_][]const u8{buffer});
+    }
+
+    pub fn read(self: *Fd, buffer: []u8) !usize {
+        return try self.readv(&[_][]u8{buffer});
+    }
+
+    pub fn writev(self: *Fd, buffers: []const []const u8) !usize {
+        try self.checkRights(.{"fd_write"});
+
+        if (self.flags.append and self.seekable()) {
+            var written = try self.pwriteInternal(buffers, null);
+            self.seek_offset = self.node.stat.size;
+            return written;
         }
 
-        // TODO: truncate
+        var written = try self.pwriteInternal(buffers, self.seek_offset);
+        self.seek_offset += @truncate(u64, written);
+        return written;
+    }
+
+    pub fn readv(self: *Fd, buffers: []const []u8) !usize {
+        try self.checkRights(.{"fd_read"});
+
+        var amount = try self.preadInternal(buffers, self.seek_offset);
+        self.seek_offset += @truncate(u64, amount);
+        return amount;
+    }
+
+    /// Write at `offset` without touching (or being affected by) the seek pointer.
+    pub fn pwrite(self: *Fd, buffers: []const []const u8, offset: u64) !usize {
+        try self.checkRights(.{ "fd_write", "fd_seek" });
+        if (!self.seekable()) return Error.NotSeekable;
 
-        var new_fd = try self.proc.?.allocator.create(Fd);
-        errdefer self.proc.?.allocator.destroy(new_fd);
+        return try self.pwriteInternal(buffers, offset);
+    }
 
-        // TODO: handle rights properly
-        new_fd .* = .{ .proc = self.proc, .node = ret_node.?, .flags = fdflags, .rights = rights_base, .inheriting_rights = inheriting_rights, .num = undefined };
+    /// Read from `offset` without touching (or being affected by) the seek pointer.
+    pub fn pread(self: *Fd, buffers: []const []u8, offset: u64) !usize {
+        try self.checkRights(.{ "fd_read", "fd_seek" });
+        if (!self.seekable()) return Error.NotSeekable;
 
-        var fd_num: Fd.Num = 0;
-        while (fd_num < Fd.max_num) {
-            new_fd.num = fd_num
+        return try self.preadInternal(buffers, offset);
+    }
+
+    // In WASI's order, so fd_seek can take its `whence` as-is.
+    pub const Whence = enum {
+        set,
+        cur,
+        end,
+    };
 
-            self.proc.?.open_nodes.putNoClobber(new_fd.num, new_fd) catch { fd_num += 1; continue; }
-            break;
+    /// Move the seek pointer and return where it ended up.
+    pub fn seek(self: *Fd, delta: i64, whence: Fd.Whence) !u64 {
+        // Asking where we are is the only thing that needs fd_tell rather than fd_seek.
+        if (delta == 0 and whence == .cur) {
+            try self.checkRights(.{"fd_tell"});
+        } else {
+            try self.checkRights(.{"fd_seek"});
         }
+        if (!self.seekable()) return Error.NotSeekable;
 
-        return new_fd;
+        var base: u64 = switch (whence) {
+            .set => 0,
+            .cur => self.seek_offset,
+            .end => self.node.stat.size,
+        };
+        var new_offset = if (delta < 0)
+            std.math.sub(u64, base, std.math.absCast(delta)) catch return Error.InvalidOffset
+        else
+            std.math.add(u64, base, std.math.absCast(delta)) catch return Error.InvalidOffset;
 
+        self.seek_offset = new_offset;
+        return new_offset;
     }
 
-    pub fn write(self: *Fd, buffer: []const u8) !usize {
-        try self.checkRights(.{"fd_write"});
+    pub fn tell(self: *Fd) !u64 {
+        return try self.seek(0, .cur);
+    }
+
+    inline fn seekable(self: *Fd) bool {
+        return switch (self.node.stat.type) {
+            .character_device, .socket, .fifo => false,
+            else => true,
+        };
+    }
+
+    /// Block until the node says `events` can make progress. Nodes without a wait queue just get polled once per yield.
+    pub fn waitReady(self: *Fd, events: vfs.Node.PollEvents) void {
+        var my_task = self.proc.?.task();
+        var queue = self.node.wait_queue orelse return my_task.yield();
+
+        var waiter: task.Waiter = undefined;
+        my_task.prepareWait();
+        my_task.waitOn(&waiter, queue);
+        defer my_task.finishWait();
 
-        var written: usize = 0;
+        while (!self.node.poll(events).any()) {
+            my_task.sleep(null);
+            my_task.prepareWait();
+        }
+    }
+
+    // A null `offset` means the end of the file, as it is once we actually get to write.
+    fn pwriteInternal(self: *Fd, buffers: []const []const u8, offset: ?u64) !usize {
         while (true) {
             self.proc.?.task().yield();
-            written = self.node.write(self.seek_offset, buffer) catch |err| switch (err) {
+            return self.node.writev(offset orelse self.node.stat.size, buffers) catch |err| switch (err) {
                 vfs.Error.Again => {
-                    if (!self.flags.nonblock) continue else return err;
+                    if (self.flags.nonblock) return err;
+                    self.waitReady(.{ .write = true });
+                    continue;
                 },
                 else => {
                     return err;
                 },
             };
-            break;
         }
-        self.seek_offset += @truncate(u64, written);
-        return written;
     }
 
-    pub fn read(self: *Fd, buffer: []u8) !usize {
-        try self.checkRights(.{"fd_read"});
-
-        var amount: usize = 0;
+    fn preadInternal(self: *Fd, buffers: []const []u8, offset: u64) !usize {
         while (true) {
             self.proc.?.task().yield();
-            amount = self.node.read(self.seek_offset, buffer) catch |err| switch (err) {
+            return self.node.readv(offset, buffers) catch |err| switch (err) {
                 vfs.Error.Again => {
-                    if (!self.flags.nonblock) continue else return err;
+                    if (self.flags.nonblock) return err;
+                    self.waitReady(.{ .read = true });
+                    continue;
                 },
                 else => {
                     return err;
                 },
             };
-            break;
         }
-        self.seek_offset += @truncate(u64, amount);
-        return amount;
     }
 
     pub fn close(self: *Fd) !void {
         try self.node.close();
         if (self.proc) |proc| {
+            _ = proc.open_nodes.remove(self.num);
             proc.allocator.destroy(self);
         }
     }
@@ -301,6 +431,10 @@ pub const Process = struct {
     pub fn deinitTrampoline(self_task: *task.Task) void {
         self_task.cookie.?.as(Process).deinit();
     }
+
+    pub fn resumeTrampoline(self_task: *task.Task) void {
+        self_task.cookie.?.as(Process).runtime.onResume();
+    }
 };
 
 pub const ProcessHost = struct {
@@ -316,6 +450,7 @@ pub const ProcessHost = struct {
         var ret = try self.scheduler.spawn(options.parent_pid, Process.entryPoint, util.asCookie(proc), options.stack_size);
         proc.internal_task = ret;
         ret.on_deinit = Process.deinitTrampoline;
+        ret.on_resume = Process.resumeTrampoline;
 
         return proc;
     }
@@ -0,0 +1,194 @@
+// Sampling profiler for wasm processes.
+// On every timer tick, whichever process is on the CPU gets its wasm call stack recorded into its own
+// histogram, if it's being profiled. Everything is exposed through a /proc-style directory with one file
+// per pid: write "start", "stop" or "reset" to it, and read it back as folded stacks
+// (`outer;inner;leaf count` per line), which flamegraph.pl and speedscope take as-is.
+
+const std = @import("std");
+const platform = @import("platform.zig");
+const util = @import("util.zig");
+const vfs = @import("vfs.zig");
+const w3 = @import("wasm3.zig");
+const process = @import("process.zig");
+const wasm_rt = @import("runtime/wasm.zig");
+
+const Node = vfs.Node;
+
+pub const max_depth = 32; // Deeper stacks lose their outermost frames
+pub const max_stacks = 256; // Distinct stacks per process; samples of any more are only counted as dropped
+
+pub const Profile = struct {
+    const Stack = struct {
+        hash: u64,
+        count: u32,
+        depth: u8,
+        truncated: bool,
+        frames: [max_depth]w3.FunctionRef, // Innermost first
+    };
+
+    stacks: [max_stacks]Stack,
+    samples: u64,
+    dropped: u64,
+
+    pub fn reset(self: *Profile) void {
+        for (self.stacks) |*stack| stack.count = 0;
+        self.samples = 0;
+        self.dropped = 0;
+    }
+
+    /// Count one sample of `frames` (innermost first). Doesn't allocate, so it's fine in interrupt context.
+    pub fn record(self: *Profile, frames: []const w3.FunctionRef) void {
+        self.samples += 1;
+
+        var truncated = frames.len > max_depth;
+        var kept = if (truncated) frames[0..max_depth] else frames;
+        var hash = std.hash.Wyhash.hash(@boolToInt(truncated), std.mem.sliceAsBytes(kept));
+
+        var probe: usize = 0;
+        while (probe < max_stacks) : (probe += 1) {
+            var stack = &self.stacks[(hash +% probe) % max_stacks];
+            if (stack.count == 0) {
+                stack.hash = hash;
+                stack.depth = @intCast(u8, kept.len);
+                stack.truncated = truncated;
+                std.mem.copy(w3.FunctionRef, stack.frames[0..], kept);
+                stack.count = 1;
+                return;
+            }
+            if (stack.hash == hash and stack.truncated == truncated and std.mem.eql(w3.FunctionRef, stack.frames[0..stack.depth], kept)) {
+                stack.count += 1;
+                return;
+            }
+        }
+        self.dropped += 1;
+    }
+
+    pub fn writeFolded(self: *Profile, writer: anytype) !void {
+        var name_buf: [32]u8 = undefined;
+        for (self.stacks) |*stack| {
+            if (stack.count == 0) continue;
+            if (stack.truncated) try writer.writeAll("[truncated];");
+            var i = stack.depth;
+            while (i > 0) {
+                i -= 1;
+                try writer.writeAll(w3.functionRefName(stack.frames[i], name_buf[0..]));
+                if (i > 0) try writer.writeAll(";");
+            }
+            try writer.print(" {}\n", .{stack.count});
+        }
+        if (self.dropped > 0) try writer.print("[dropped] {}\n", .{self.dropped});
+    }
+};
+
+fn wasmRuntime(proc: *process.Process) ?*wasm_rt.Runtime {
+    return switch (proc.runtime) {
+        .wasm => |*rt| rt,
+        else => null,
+    };
+}
+
+/// Take a sample of whatever is running. Called from the timer tick.
+pub fn sample(host: *process.ProcessHost) void {
+    var running = host.scheduler.running orelse return;
+    var rt = wasmRuntime(running.cookie.?.as(process.Process)) orelse return;
+    if (!rt.profiling) return;
+    var profile = rt.profile orelse return;
+
+    var buf: [max_depth + 1]w3.FunctionRef = undefined;
+    var frames = rt.wasm3.callStack(buf[0..]);
+    if (frames.len > 0) profile.record(frames);
+}
+
+// Per-pid nodes are handed out from here instead of being allocated, so one that outlives its process
+// can't dangle; it just starts failing with NoSuchFile.
+var pid_nodes: [16]Node = undefined;
+var pid_nodes_used: usize = 0;
+
+/// The directory to preopen as e.g. /proc/profile.
+pub fn openDir(host: *process.ProcessHost) Node {
+    return Node.init(.{ .find = findPid }, util.asCookie(host), Node.Stat{ .type = .directory, .mode = Node.Mode.init(0o555) }, null);
+}
+
+fn findPid(self: *Node, name: []const u8) !vfs.File {
+    var host = self.cookie.?.as(process.ProcessHost);
+    var pid = std.fmt.parseInt(process.Process.Id, name, 10) catch return vfs.Error.NoSuchFile;
+    if (pid < 0 or host.get(pid) == null) return vfs.Error.NoSuchFile;
+
+    // This pid's node if someone has it open already, otherwise any nobody has open.
+    var slot: ?*Node = null;
+    for (pid_nodes[0..pid_nodes_used]) |*candidate| {
+        if (candidate.opens.refs == 0) {
+            if (slot == null) slot = candidate;
+        } else if (candidate.stat.inode == @intCast(u64, pid)) {
+            slot = candidate;
+            break;
+        }
+    }
+    if (slot == null) {
+        if (pid_nodes_used == pid_nodes.len) return vfs.Error.NoSpace;
+        slot = &pid_nodes[pid_nodes_used];
+        pid_nodes_used += 1;
+        slot.?.opens = .{};
+    }
+
+    var node = slot.?;
+    if (node.opens.refs == 0) {
+        node.* = Node.init(.{ .read = readProfile, .write = control }, self.cookie, Node.Stat{ .type = .file, .inode = @intCast(u64, pid), .mode = Node.Mode.init(0o644) }, null);
+    }
+    try node.open();
+
+    var file = vfs.File{ .node = node, .name_ptr = null, .name_len = name.len };
+    std.mem.copy(u8, file.name_buf[0..], name);
+    return file;
+}
+
+fn profiledRuntime(self: *Node) !*wasm_rt.Runtime {
+    var host = self.cookie.?.as(process.ProcessHost);
+    var proc = host.get(@intCast(process.Process.Id, self.stat.inode)) orelse return vfs.Error.NoSuchFile;
+    return wasmRuntime(proc) orelse vfs.Error.NotImplemented;
+}
+
+fn readProfile(self: *Node, offset: u64, buffer: []u8) !usize {
+    var rt = try profiledRuntime(self);
+    var profile = rt.profile orelse return 0;
+
+    var text = std.ArrayList(u8).init(self.cookie.?.as(process.ProcessHost).allocator);
+    defer text.deinit();
+    {
+        var old_tpl = platform.enterCritical();
+        defer platform.leaveCritical(old_tpl);
+        try profile.writeFolded(text.writer());
+    }
+
+    if (offset >= text.items.len) return 0;
+    var start = @intCast(usize, offset);
+    var end = std.math.min(text.items.len, start + buffer.len);
+    std.mem.copy(u8, buffer, text.items[start..end]);
+    return end - start;
+}
+
+fn control(self: *Node, offset: u64, buffer: []const u8) !usize {
+    var rt = try profiledRuntime(self);
+    var command = std.mem.trim(u8, buffer, " \t\r\n");
+
+    if (std.mem.eql(u8, command, "start")) {
+        if (rt.profile == null) {
+            var profile = try rt.proc.allocator.create(Profile);
+            profile.reset();
+            rt.profile = profile;
+        }
+        rt.wasm3.setRecordCallStack(true);
+        rt.profiling = true;
+    } else if (std.mem.eql(u8, command, "stop")) {
+        rt.profiling = false;
+        rt.wasm3.setRecordCallStack(false);
+    } else if (std.mem.eql(u8, command, "reset")) {
+        var profile = rt.profile orelse return buffer.len;
+        var old_tpl = platform.enterCritical();
+        defer platform.leaveCritical(old_tpl);
+        profile.reset();
+    } else {
+        return vfs.Error.WriteFailed;
+    }
+    return buffer.len;
+}
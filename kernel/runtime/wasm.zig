@@ -4,17 +4,87 @@ const std = @import("std");
 const process = @import("../process.zig");
 const platform = @import("../platform.zig");
 const util = @import("../util.zig");
+const time = @import("../time.zig");
+const idle = @import("../idle.zig");
 const w3 = @import("../wasm3.zig");
+const profiler = @import("../profiler.zig");
 
 const wasi = @import("wasm/wasi.zig");
 
 const Process = process.Process;
 
+/// Snapshots of freshly initialised instances, keyed by their image. Spawning the same binary again
+/// copies memory, globals and table out of here instead of running data segments, the start function and
+/// the guest's `wizer.initialize` (if it exports one) all over again.
+const snapshots = struct {
+    const Entry = struct {
+        hash: u64 = 0,
+        image: []const u8 = &[_]u8{}, // Our own copy; the hash only narrows the search down
+        snapshot: ?w3.Snapshot = null,
+        clock_page: ?u32 = null, // Registered during initialisation, so restoring memory alone would lose it
+    };
+
+    const Key = struct {
+        hash: u64,
+        image: []const u8,
+    };
+
+    const max_entries = 8;
+    const max_bytes = 16 * 1024 * 1024;
+
+    var entries = [_]Entry{.{}} ** max_entries;
+    var next_victim: usize = 0;
+    var total_bytes: usize = 0;
+
+    fn find(key: Key) ?*const Entry {
+        for (entries) |*entry| {
+            if (entry.snapshot != null and entry.hash == key.hash and std.mem.eql(u8, entry.image, key.image)) return entry;
+        }
+        return null;
+    }
+
+    fn evict(entry: *Entry) void {
+        if (entry.snapshot) |*snapshot| {
+            total_bytes -= snapshot.size() + entry.image.len;
+            snapshot.deinit();
+            platform.heap_allocator.free(entry.image);
+        }
+        entry.snapshot = null;
+        entry.image = &[_]u8{};
+    }
+
+    /// Takes ownership of `snapshot`, freeing older ones round-robin to make room.
+    fn insert(key: Key, snapshot: w3.Snapshot, clock_page: ?u32) void {
+        var new_snapshot = snapshot;
+        var size = new_snapshot.size() + key.image.len;
+        if (size > max_bytes) {
+            new_snapshot.deinit();
+            return;
+        }
+        var image = platform.heap_allocator.dupe(u8, key.image) catch {
+            new_snapshot.deinit();
+            return;
+        };
+
+        var entry = &entries[next_victim];
+        next_victim = (next_victim + 1) % max_entries;
+        evict(entry);
+        for (entries) |*other| {
+            if (total_bytes + size <= max_bytes) break;
+            evict(other);
+        }
+
+        entry.* = .{ .hash = key.hash, .image = image, .snapshot = new_snapshot, .clock_page = clock_page };
+        total_bytes += size;
+    }
+};
+
 pub const Runtime = struct {
     pub const Args = struct {
         wasm_image: []u8,
         stack_size: usize = 64 * 1024,
         link_wasi: bool = true,
+        use_snapshot: bool = true, // Start from (and save) a snapshot of the initialised instance
     };
 
     proc: *Process,
@@ -24,32 +94,150 @@ pub const Runtime = struct {
 
     wasi_impl: w3.NativeModule = undefined,
     debug_impl: w3.NativeModule = undefined,
+    clock_impl: w3.NativeModule = undefined,
+    clock_page: ?u32 = null, // Offset of the guest's ClockPage in linear memory, if it registered one
+    // Latest monotonic and uptime values handed to the guest. Coarse readings lag fine ones by up to a tick,
+    // so everything goes through clampClock to keep those clocks from stepping backwards.
+    last_monotonic: i64 = 0,
+    last_uptime: i64 = 0,
     entry_point: w3.Function = undefined,
+    // Set unless we started from a snapshot: start() then runs the guest's own initialisation first, and
+    // saves a snapshot under `snapshot_key` if there is one.
+    needs_initialize: bool = false,
+    snapshot_key: ?snapshots.Key = null,
+
+    precompile_work: idle.Work = idle.Work.init(precompileStep, null),
+    precompiled_functions: usize = 0, // Functions compiled during idle time, before anything called them
+    precompiled_bytes: usize = 0,
+
+    profile: ?*profiler.Profile = null, // Allocated the first time someone starts profiling us
+    profiling: bool = false,
 
     pub fn init(proc: *Process, args: Runtime.Args) !Runtime {
         var ret = Runtime{ .proc = proc, .wasm3 = try w3.Runtime.init(args.stack_size) };
+        errdefer ret.wasm3.deinit();
 
         ret.wasi_impl = try w3.NativeModule.init(proc.allocator, "", wasi.Preview1, proc);
         errdefer ret.wasi_impl.deinit();
         ret.debug_impl = try w3.NativeModule.init(proc.allocator, "", wasi.Debug, proc);
         errdefer ret.debug_impl.deinit();
+        ret.clock_impl = try w3.NativeModule.init(proc.allocator, "", wasi.SharedClock, proc);
+        errdefer ret.clock_impl.deinit();
 
-        ret.module = try ret.wasm3.parseAndLoadModule(args.wasm_image);
+        var image_key = snapshots.Key{ .hash = std.hash.Wyhash.hash(0, args.wasm_image), .image = args.wasm_image };
+        var cached = if (args.use_snapshot) snapshots.find(image_key) else null;
+        if (cached) |entry| {
+            if (ret.wasm3.parseAndLoadModuleFromSnapshot(args.wasm_image, &entry.snapshot.?)) |module| {
+                ret.module = module;
+                ret.clock_page = entry.clock_page;
+            } else |_| {
+                cached = null;
+                ret.module = try ret.wasm3.parseAndLoadModule(args.wasm_image);
+            }
+        } else {
+            ret.module = try ret.wasm3.parseAndLoadModule(args.wasm_image);
+        }
         try ret.linkStd(ret.module);
 
+        if (cached == null) {
+            ret.needs_initialize = true;
+            if (args.use_snapshot) ret.snapshot_key = image_key;
+        }
+
         ret.entry_point = try ret.wasm3.findFunction("_start");
 
         return ret;
     }
 
     pub fn linkStd(self: *Runtime, module: w3.Module) !void {
+        var bindings: [wasi.Preview1.namespaces.len + wasi.Debug.namespaces.len + wasi.SharedClock.namespaces.len]w3.ImportBinding = undefined;
+        var i: usize = 0;
         for (wasi.Preview1.namespaces) |namespace| {
-            self.wasi_impl.link(namespace, module);
+            bindings[i] = .{ .namespace = namespace, .native = &self.wasi_impl };
+            i += 1;
+        }
+        for (wasi.Debug.namespaces) |namespace| {
+            bindings[i] = .{ .namespace = namespace, .native = &self.debug_impl };
+            i += 1;
+        }
+        for (wasi.SharedClock.namespaces) |namespace| {
+            bindings[i] = .{ .namespace = namespace, .native = &self.clock_impl };
+            i += 1;
+        }
+        try module.linkImports(bindings[0..]);
+    }
+
+    /// Refresh the guest's clock page, if it has one. Called whenever the process gets the CPU back.
+    pub fn publishClock(self: *Runtime) void {
+        var offset = self.clock_page orelse return;
+        var memory = self.wasm3.memory();
+        // The guest may have shrunk out from under it (it can't, today, but don't trust that).
+        if (@as(u64, offset) + @sizeOf(wasi.ClockPage) > memory.len) {
+            self.clock_page = null;
+            return;
+        }
+        var page = @ptrCast(*align(1) volatile wasi.ClockPage, &memory[offset]);
+
+        var seq = page.seq +% 1;
+        if (seq & 1 == 0) seq +%= 1;
+        page.seq = seq; // Odd: update in progress
+        @fence(.SeqCst);
+        page.resolution = @intCast(u64, time.getResolution());
+        page.realtime = @bitCast(u64, time.getClockNano(.real));
+        page.monotonic = @bitCast(u64, self.clampClock(.monotonic, time.getClockNano(.monotonic)));
+        page.uptime = @bitCast(u64, self.clampClock(.uptime, time.getClockNano(.uptime)));
+        @fence(.SeqCst);
+        page.seq = seq +% 1;
+    }
+
+    /// `value`, a reading of `clock`, or the last value the guest saw of it if that was later.
+    pub fn clampClock(self: *Runtime, comptime clock: enum { monotonic, uptime }, value: i64) i64 {
+        var last = &@field(self, "last_" ++ @tagName(clock));
+        if (value > last.*) last.* = value;
+        return last.*;
+    }
+
+    fn precompileStep(work: *idle.Work) bool {
+        var self = work.cookie.?.as(Runtime);
+        var step = self.module.compileAhead() catch return false;
+        if (step.wasm_bytes > 0) {
+            self.precompiled_functions += 1;
+            self.precompiled_bytes += step.wasm_bytes;
         }
-        self.debug_impl.link("shinkou_debug", module);
+        return step.more;
+    }
+
+    /// Run the initialisation the guest wants done once, ahead of _start (wizer's convention), and snapshot
+    /// the result. Host calls find the runtime through the process, so this can't happen before start().
+    fn initialize(self: *Runtime) !void {
+        if (self.wasm3.findFunction("wizer.initialize")) |initialize_fn| {
+            _ = try initialize_fn.callVoid(void);
+        } else |_| {}
+
+        // Whatever the start function or init got out of WASI (args, environment, files, the time) is this
+        // spawn's alone; like Wizer, only snapshot instances that didn't ask.
+        if (self.wasi_impl.calls() != 0) return;
+        var key = self.snapshot_key orelse return;
+        if (self.module.snapshot()) |snapshot| snapshots.insert(key, snapshot, self.clock_page) else |_| {}
     }
 
     pub fn start(self: *Runtime) void {
+        // Only now does `self` have its final address. Nothing is worth compiling once the guest exits.
+        self.precompile_work.cookie = util.asCookie(self);
+        idle.schedule(&self.precompile_work);
+        defer idle.cancel(&self.precompile_work);
+        defer if (self.precompiled_functions > 0) {
+            platform.earlyprintf("{}: compiled {} functions ({} bytes of wasm) ahead of time\r\n", .{ self.proc.name, self.precompiled_functions, self.precompiled_bytes });
+        };
+
+        if (self.needs_initialize) {
+            self.needs_initialize = false;
+            self.initialize() catch |err| {
+                platform.earlyprintf("ERR: {}\r\n", .{@errorName(err)});
+                return;
+            };
+        }
+
         _ = self.entry_point.callVoid(void) catch |err| {
             switch (err) {
                 w3.Error.Exit => {
@@ -63,8 +251,13 @@ pub const Runtime = struct {
     }
 
     pub fn deinit(self: *Runtime) void {
+        idle.cancel(&self.precompile_work);
+        // Frees our module along with the runtime, and hands the code pages to the shared pool for the next spawn.
+        self.wasm3.deinit();
         self.wasi_impl.deinit();
         self.debug_impl.deinit();
+        self.clock_impl.deinit();
+        if (self.profile) |profile| self.proc.allocator.destroy(profile);
         self.proc.allocator.destroy(self);
     }
 };
@@ -1,8 +1,10 @@
 gconst std = @import("std");
 const process = @import("../../process.zig");
+const task = @import("../../task.zig");
 const platform = @import("../../platform.zig");
 const time = @import("../../time.zig");
 const util = @import("../../util.zig");
+const vfs = @import("../../vfs.zig");
 const w3 = @import("../../wasm3.zig");
 const syscall = @import("../../syscall.zig");
 
@@ -32,6 +34,44 @@ pub const Debug = struct {
     }
 };
 
+/// Layout of the clock page a guest can register with `shinkou_clock.clock_page_register`.
+/// WebAssembly can't read the TSC itself, so instead of a scale and offset the kernel publishes the clock values
+/// directly, every time the process enters or leaves the kernel (any host call, yield, or preemption).
+/// To read it: load `seq`, and retry while it's odd; read the fields; retry if `seq` changed meanwhile.
+/// In a long stretch without host calls the page goes stale, so readers should fall back to `clock_time_get`
+/// (which also refreshes the page) after seeing the same `seq` many times in a row.
+pub const ClockPage = extern struct {
+    seq: u32,
+    version: u32 = 1,
+    resolution: u64, // Of the published values when fresh, in nanoseconds
+    realtime: u64,
+    monotonic: u64,
+    uptime: u64,
+};
+
+pub const SharedClock = struct {
+    pub const namespaces = [_][:0]const u8{"shinkou_clock"};
+
+    /// Start publishing time to the ClockPage at `page` (8-byte aligned), or stop if `page` is 0.
+    pub fn clock_page_register(ctx: w3.ZigFunctionCtx, args: struct { page: u32 }) !u32 {
+        util.compAssert(@sizeOf(ClockPage) == 40);
+
+        var runtime = &myProc(ctx).runtime.wasm;
+        if (args.page == 0) {
+            runtime.clock_page = null;
+            return errnoInt(.ESUCCESS);
+        }
+        if (args.page % 8 != 0) return errnoInt(.EINVAL);
+        if (@as(u64, args.page) + @sizeOf(ClockPage) > ctx.memory.len) return errnoInt(.EFAULT);
+
+        var page = @ptrCast(*align(1) ClockPage, &ctx.memory[args.page]);
+        page.* = .{ .seq = 0, .resolution = 0, .realtime = 0, .monotonic = 0, .uptime = 0 };
+        runtime.clock_page = args.page;
+        runtime.publishClock();
+        return errnoInt(.ESUCCESS);
+    }
+};
+
 pub const Preview1 = struct {
     pub const namespaces = [_][:0]const u8{ "wasi_snapshot_preview1", "wasi_unstable" };
 
@@ -57,16 +97,31 @@ pub const Preview1 = struct {
         return errnoInt(.ESUCCESS);
     }
 
-    pub fn clock_time_get(ctx: w3.ZigFunctionCtx, args: struct { clock_id: Clock, precision: i64, timestamp: w3.u64_ptr }) !u32 {
+    pub fn clock_time_get(ctx: w3.ZigFunctionCtx, args: struct { clock_id: Clock, precision: u64, timestamp: w3.u64_ptr }) !u32 {
+        // Guests fall back to us when their clock page looks stale, so freshen it while we're here.
+        var runtime = &myProc(ctx).runtime.wasm;
+        runtime.publishClock();
+
+        // If the caller can live with tick precision, skip reading the cycle counter.
+        // That reading can be older than a fine one we already gave out, hence clampClock.
+        var coarse = args.precision >= @intCast(u64, time.getCoarseResolution());
         args.timestamp.* = @bitCast(u64, switch (args.clock_id) {
-            .realtime => time.getClockNano(.real),
-            .monotonic => time.getClockNano(.monotonic),
-            .uptime => time.getClockNano(.uptime),
+            .realtime => if (coarse) time.getClockNanoCoarse(.real) else time.getClockNano(.real),
+            .monotonic => runtime.clampClock(.monotonic, if (coarse) time.getClockNanoCoarse(.monotonic) else time.getClockNano(.monotonic)),
+            .uptime => runtime.clampClock(.uptime, if (coarse) time.getClockNanoCoarse(.uptime) else time.getClockNano(.uptime)),
             else => { return errnoInt(.EINVAL); }
         });
         return errnoInt(.ESUCCESS);
     }
 
+    pub fn clock_res_get(ctx: w3.ZigFunctionCtx, args: struct { clock_id: Clock, resolution: w3.u64_ptr }) !u32 {
+        switch (args.clock_id) {
+            .realtime, .monotonic, .uptime => args.resolution.* = @intCast(u64, time.getResolution()),
+            else => return errnoInt(.EINVAL),
+        }
+        return errnoInt(.ESUCCESS);
+    }
+
     pub fn fd_prestat_get(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, prestat: *align(1) Self.PrestatDir }) !u32 {
         util.compAssert(@sizeOf(Self.PrestatDir) == 8);
 
@@ -103,34 +158,322 @@ pub const Preview1 = struct {
         return errnoInt(.EBADF);
     }
 
-    pub fn fd_write(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, iovecs: []align(1) Self.IoVec, written: w3.u32_ptr }) !u32 {
+    // How many iovecs we gather per driver call. Anything past this goes in another call.
+    const iovec_batch = 64;
+
+    // Turn guest iovecs into slices of linear memory. Returns null if any of them points outside it.
+    fn gatherIoVecs(memory: []u8, iovecs: []align(1) const Self.IoVec, out: [][]u8) ?[][]u8 {
+        for (iovecs) |iovec, i| {
+            var end = @as(u64, iovec.bufptr) + iovec.buflen;
+            if (end > memory.len) return null;
+            out[i] = memory[iovec.bufptr..@truncate(usize, end)];
+        }
+        return out[0..iovecs.len];
+    }
+
+    const IoOp = enum { read, write, pread, pwrite };
+
+    // Move data between `fd` and the buffers behind a guest iovec array, `iovec_batch` iovecs per driver call.
+    // Like a short read/write, once anything has moved a later failure (even a bad iovec) just ends the call early.
+    fn transferIoVecs(comptime op: Self.IoOp, ctx: w3.ZigFunctionCtx, fd: *process.Fd, iovecs: []align(1) const Self.IoVec, offset: u64, done: w3.u32_ptr) u32 {
         util.compAssert(@sizeOf(Self.IoVec) == 8);
 
-        myProc(ctx).task().yield();
+        var slices: [Self.iovec_batch][]u8 = undefined;
+        var remaining = iovecs;
+        while (remaining.len > 0) {
+            var batch = remaining[0..std.math.min(remaining.len, Self.iovec_batch)];
+            remaining = remaining[batch.len..];
+
+            var buffers = Self.gatherIoVecs(ctx.memory, batch, slices[0..]) orelse {
+                if (done.* > 0) break;
+                return errnoInt(.EFAULT);
+            };
+            var wanted: usize = 0;
+            for (buffers) |buffer| wanted += buffer.len;
+
+            // Can only overflow after an earlier batch moved something, so there's always a count to report.
+            var pos = std.math.add(u64, offset, done.*) catch break;
+            var amount = switch (op) {
+                .read => fd.readv(buffers),
+                .write => fd.writev(buffers),
+                .pread => fd.pread(buffers, pos),
+                .pwrite => fd.pwrite(buffers, pos),
+            } catch |err| {
+                if (done.* > 0) break;
+                return errnoInt(errorToNo(err));
+            };
+            done.* += @truncate(u32, amount);
+            if (amount < wanted) break;
+        }
+        return errnoInt(.ESUCCESS);
+    }
+
+    pub fn fd_write(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, iovecs: []align(1) Self.IoVec, written: w3.u32_ptr }) !u32 {
         args.written.* = 0;
         if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
-            for (args.iovecs) |iovec| {
-                args.written.* += @truncate(u32, fd.write(ctx.memory[iovec.bufptr .. iovec.bufptr + iovec.buflen]) catch |err| return errnoInt(errorToNo(err)));
-            }
-            return errnoInt(.ESUCCESS);
+            return Self.transferIoVecs(.write, ctx, fd, args.iovecs, 0, args.written);
         }
         return errnoInt(.EBADF);
     }
 
     pub fn fd_read(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, iovecs: []align(1) Self.IoVec, amount: w3.u32_ptr }) !u32 {
-        util.compAssert(@sizeOf(Self.IoVec) == 8);
+        args.amount.* = 0;
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            return Self.transferIoVecs(.read, ctx, fd, args.iovecs, 0, args.amount);
+        }
+        return errnoInt(.EBADF);
+    }
 
-        myProc(ctx).task().yield();
+    pub fn fd_pwrite(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, iovecs: []align(1) Self.IoVec, offset: u64, written: w3.u32_ptr }) !u32 {
+        args.written.* = 0;
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            return Self.transferIoVecs(.pwrite, ctx, fd, args.iovecs, args.offset, args.written);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    pub fn fd_pread(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, iovecs: []align(1) Self.IoVec, offset: u64, amount: w3.u32_ptr }) !u32 {
         args.amount.* = 0;
         if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
-            for (args.iovecs) |iovec| {
-                args.amount.* += @truncate(u32, fd.read(ctx.memory[iovec.bufptr .. iovec.bufptr + iovec.buflen]) catch |err| return errnoInt(errorToNo(err)));
+            return Self.transferIoVecs(.pread, ctx, fd, args.iovecs, args.offset, args.amount);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    pub fn fd_seek(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, offset: i64, whence: u32, new_offset: w3.u64_ptr }) !u32 {
+        var whence = std.meta.intToEnum(process.Fd.Whence, args.whence) catch return errnoInt(.EINVAL);
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            args.new_offset.* = fd.seek(args.offset, whence) catch |err| return errnoInt(errorToNo(err));
+            return errnoInt(.ESUCCESS);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    pub fn fd_tell(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, offset: w3.u64_ptr }) !u32 {
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            args.offset.* = fd.tell() catch |err| return errnoInt(errorToNo(err));
+            return errnoInt(.ESUCCESS);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    pub fn fd_close(ctx: w3.ZigFunctionCtx, args: struct { fd: u32 }) !u32 {
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            fd.close() catch |err| return errnoInt(errorToNo(err));
+            return errnoInt(.ESUCCESS);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    pub fn path_open(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, lookup_flags: u32, path: []u8, oflags: u32, rights_base: u64, rights_inheriting: u64, fdflags: u32, opened_fd: w3.u32_ptr }) !u32 {
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            // We don't have symlinks yet, so lookup_flags (symlink_follow) changes nothing.
+            var new_fd = fd.open(
+                args.path,
+                .{ .Int = @truncate(u16, args.oflags) },
+                .{ .Int = args.rights_base },
+                .{ .Int = args.rights_inheriting },
+                .{ .append = args.fdflags & 0x1 != 0, .nonblock = args.fdflags & 0x4 != 0, .sync = args.fdflags & 0x10 != 0 },
+                vfs.Node.Mode.init(0o644),
+            ) catch |err| return errnoInt(errorToNo(err));
+            args.opened_fd.* = new_fd.num;
+            return errnoInt(.ESUCCESS);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    // How many entries we ask the driver for at once. Each vfs.File is a few hundred bytes of stack.
+    const readdir_batch = 32;
+
+    pub fn fd_readdir(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, buf: []u8, cookie: u64, buf_used: w3.u32_ptr }) !u32 {
+        util.compAssert(@sizeOf(Dirent) == 24);
+
+        args.buf_used.* = 0;
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            var files: [Self.readdir_batch]vfs.File = undefined;
+            var used: usize = 0;
+            var cookie = args.cookie;
+
+            while (used < args.buf.len) {
+                // Don't have the driver produce entries that can't possibly fit.
+                var want = std.math.min(files.len, (args.buf.len - used) / @sizeOf(Dirent) + 1);
+                var count = fd.readDir(cookie, files[0..want]) catch |err| {
+                    if (used > 0) break;
+                    return errnoInt(errorToNo(err));
+                };
+                if (count == 0) break;
+
+                for (files[0..count]) |*file| {
+                    var name = file.name();
+                    var dirent = Dirent{ .next = file.dir_cookie, .inode = file.inode, .name_len = @truncate(u32, name.len), .filetype = Self.filetypeOf(file.type) };
+
+                    // WASI wants as much of the last entry as fits; a full buffer tells libc to come back with a bigger one.
+                    for ([_][]const u8{ std.mem.asBytes(&dirent), name }) |piece| {
+                        var amount = std.math.min(piece.len, args.buf.len - used);
+                        std.mem.copy(u8, args.buf[used..], piece[0..amount]);
+                        used += amount;
+                    }
+                    if (used == args.buf.len) break;
+                    cookie = file.dir_cookie;
+                }
+                if (count < want) break;
             }
+
+            args.buf_used.* = @truncate(u32, used);
+            return errnoInt(.ESUCCESS);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    pub fn path_filestat_get(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, lookup_flags: u32, path: []u8, stat: *align(1) Filestat }) !u32 {
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            fd.checkRights(.{"path_filestat_get"}) catch |err| return errnoInt(errorToNo(err));
+            myProc(ctx).task().yield();
+
+            var file = fd.node.findRecursive(args.path) catch |err| return errnoInt(errorToNo(err));
+            defer file.node.close() catch {};
+
+            args.stat.* = Self.filestatOf(file.node);
+            return errnoInt(.ESUCCESS);
+        }
+        return errnoInt(.EBADF);
+    }
+
+    pub fn fd_filestat_get(ctx: w3.ZigFunctionCtx, args: struct { fd: u32, stat: *align(1) Filestat }) !u32 {
+        if (myProc(ctx).open_nodes.get(@truncate(process.Fd.Num, args.fd))) |fd| {
+            fd.checkRights(.{"fd_filestat_get"}) catch |err| return errnoInt(errorToNo(err));
+            args.stat.* = Self.filestatOf(fd.node);
             return errnoInt(.ESUCCESS);
         }
         return errnoInt(.EBADF);
     }
 
+    // Subscriptions we can wait on without going to the heap for their state.
+    const poll_stack_slots = 16;
+
+    // Per-subscription state for poll_oneoff.
+    const PollSlot = struct {
+        waiter: task.Waiter, // fd subscriptions
+        deadline: i64, // clock subscriptions, on the monotonic clock
+    };
+
+    pub fn poll_oneoff(ctx: w3.ZigFunctionCtx, args: struct { in: u32, out: u32, count: u32, nevents: w3.u32_ptr }) !u32 {
+        util.compAssert(@sizeOf(Subscription) == 48);
+        util.compAssert(@sizeOf(Event) == 32);
+
+        args.nevents.* = 0;
+        if (args.count == 0) return errnoInt(.EINVAL);
+        if (@as(u64, args.in) + @as(u64, args.count) * @sizeOf(Subscription) > ctx.memory.len) return errnoInt(.EFAULT);
+        if (@as(u64, args.out) + @as(u64, args.count) * @sizeOf(Event) > ctx.memory.len) return errnoInt(.EFAULT);
+
+        var proc = myProc(ctx);
+        var my_task = proc.task();
+        var subs = @ptrCast([*]align(1) Subscription, &ctx.memory[args.in])[0..args.count];
+        var events = @ptrCast([*]align(1) Event, &ctx.memory[args.out])[0..args.count];
+
+        var stack_slots: [Self.poll_stack_slots]Self.PollSlot = undefined;
+        var slots: []Self.PollSlot = stack_slots[0..];
+        if (args.count > stack_slots.len) slots = platform.heap_allocator.alloc(Self.PollSlot, args.count) catch return errnoInt(.ENOMEM);
+        defer if (args.count > stack_slots.len) platform.heap_allocator.free(slots);
+
+        // Clock subscriptions are all turned into deadlines on the monotonic clock, once, up front:
+        // an absolute time has to be measured against its own clock's "now" at the start, not at every wakeup.
+        var start = time.now();
+        var deadline: ?i64 = null;
+
+        my_task.prepareWait();
+        defer my_task.finishWait();
+
+        for (subs) |sub, i| {
+            switch (std.meta.intToEnum(EventType, sub.tag) catch return errnoInt(.EINVAL)) {
+                .clock => {
+                    var when = Self.clockDeadline(sub, start) orelse return errnoInt(.EINVAL);
+                    slots[i].deadline = when;
+                    if (deadline == null or when < deadline.?) deadline = when;
+                },
+                .fd_read, .fd_write => {
+                    var fd = proc.open_nodes.get(@truncate(process.Fd.Num, sub.u.fd_readwrite.fd)) orelse continue;
+                    if (fd.node.wait_queue) |queue| my_task.waitOn(&slots[i].waiter, queue);
+                },
+            }
+        }
+
+        while (true) {
+            var current = time.now();
+            var count: u32 = 0;
+
+            for (subs) |sub, i| {
+                var event = Event{ .userdata = sub.userdata, .errno = @truncate(u16, errnoInt(.ESUCCESS)), .tag = sub.tag };
+                var tag = @intToEnum(EventType, sub.tag); // Validated above
+                switch (tag) {
+                    .clock => {
+                        if (slots[i].deadline > current) continue;
+                    },
+                    .fd_read, .fd_write => {
+                        if (proc.open_nodes.get(@truncate(process.Fd.Num, sub.u.fd_readwrite.fd))) |fd| {
+                            var wanted = vfs.Node.PollEvents{ .read = tag == .fd_read, .write = tag == .fd_write };
+                            if (!fd.node.poll(wanted).any()) continue;
+                            if (fd.node.stat.type == .file and fd.node.stat.size > fd.seek_offset) event.nbytes = fd.node.stat.size - fd.seek_offset;
+                        } else {
+                            event.errno = @truncate(u16, errnoInt(.EBADF));
+                        }
+                    },
+                }
+                events[count] = event;
+                count += 1;
+            }
+
+            if (count > 0) {
+                args.nevents.* = count;
+                return errnoInt(.ESUCCESS);
+            }
+
+            my_task.sleep(deadline);
+            my_task.prepareWait();
+        }
+    }
+
+    fn clockDeadline(sub: Subscription, start: i64) ?i64 {
+        var clock = std.meta.intToEnum(Clock, sub.u.clock.id) catch return null;
+        var timeout = std.math.cast(i64, sub.u.clock.timeout) catch std.math.maxInt(i64);
+        if (sub.u.clock.flags & subclockflag_abstime == 0) return std.math.add(i64, start, timeout) catch std.math.maxInt(i64);
+
+        var clock_now = switch (clock) {
+            .realtime => time.getClockNano(.real),
+            .monotonic => time.getClockNano(.monotonic),
+            .uptime => time.getClockNano(.uptime),
+            else => return null,
+        };
+        return std.math.add(i64, start, timeout -% clock_now) catch std.math.maxInt(i64);
+    }
+
+    fn filetypeOf(typ: vfs.Node.Type) Filetype {
+        return switch (typ) {
+            .file => .regular_file,
+            .directory => .directory,
+            .block_device => .block_device,
+            .character_device => .character_device,
+            .symlink => .symbolic_link,
+            .socket => .socket_stream,
+            else => .unknown,
+        };
+    }
+
+    fn filestatOf(node: *vfs.Node) Filestat {
+        util.compAssert(@sizeOf(Filestat) == 64);
+
+        return .{
+            .dev = if (node.file_system) |fs| fs.dev else 0,
+            .inode = node.stat.inode,
+            .filetype = Self.filetypeOf(node.stat.type),
+            .nlink = @bitCast(u64, node.stat.links),
+            .size = node.stat.size,
+            .atim = @bitCast(u64, node.stat.access_time),
+            .mtim = @bitCast(u64, node.stat.modify_time),
+            .ctim = @bitCast(u64, node.stat.create_time),
+        };
+    }
+
     pub fn args_sizes_get(ctx: w3.ZigFunctionCtx, args: struct { argc: w3.u32_ptr, argv_buf_size: w3.u32_ptr }) !u32 {
         args.argc.* = @truncate(u32, myProc(ctx).argc);
         args.argv_buf_size.* = @truncate(u32, myProc(ctx).argv.len) + 1;
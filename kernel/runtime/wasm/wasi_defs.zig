@@ -86,6 +86,74 @@ pub const Clock = enum(u32) {
     uptime, // Extension
 };
 
+pub const Filetype = enum(u8) {
+    unknown,
+    block_device,
+    character_device,
+    directory,
+    regular_file,
+    socket_dgram,
+    socket_stream,
+    symbolic_link,
+};
+
+pub const Dirent = extern struct {
+    next: u64,
+    inode: u64,
+    name_len: u32,
+    filetype: Filetype,
+    _padding: [3]u8 = [_]u8{0} ** 3,
+}; // Followed by the name, not null-terminated
+
+pub const Filestat = extern struct {
+    dev: u64,
+    inode: u64,
+    filetype: Filetype,
+    _padding: [7]u8 = [_]u8{0} ** 7,
+    nlink: u64,
+    size: u64,
+    atim: u64,
+    mtim: u64,
+    ctim: u64,
+};
+
+pub const EventType = enum(u8) {
+    clock,
+    fd_read,
+    fd_write,
+};
+
+pub const subclockflag_abstime: u16 = 1;
+
+pub const Subscription = extern struct {
+    userdata: u64,
+    tag: u8, // EventType
+    _padding: [7]u8,
+    u: extern union {
+        clock: extern struct {
+            id: u32,
+            _padding: u32,
+            timeout: u64,
+            precision: u64,
+            flags: u16,
+            _padding2: [6]u8,
+        },
+        fd_readwrite: extern struct {
+            fd: u32,
+        },
+    },
+};
+
+pub const Event = extern struct {
+    userdata: u64,
+    errno: u16,
+    tag: u8, // EventType
+    _padding: [5]u8 = [_]u8{0} ** 5,
+    nbytes: u64 = 0,
+    flags: u16 = 0,
+    _padding2: [6]u8 = [_]u8{0} ** 6,
+};
+
 pub inline fn errnoInt(err: Errno) u32 {
     return @enumToInt(err);
 }
@@ -95,6 +163,20 @@ pub inline fn errorToNo(err: anyerror) Errno {
         error.Success, error.None => .ESUCCESS,
         error.BadFd => .EBADF,
         error.ReadFailed, error.WriteFailed => .EIO,
+        error.NotCapable => .ENOTCAPABLE,
+        error.NotSeekable => .ESPIPE,
+        error.InvalidOffset => .EINVAL,
+        error.Again => .EAGAIN,
+        error.NoSuchFile => .ENOENT,
+        error.NotDirectory => .ENOTDIR,
+        error.NotFile => .EISDIR,
+        error.FileExists => .EEXIST,
+        error.NotEmpty => .ENOTEMPTY,
+        error.PathTooLong, error.NameTooLong => .ENAMETOOLONG,
+        error.FileTooBig => .EFBIG,
+        error.NoSpace => .ENOSPC,
+        error.TooManyOpenFiles => .EMFILE,
+        error.OutOfMemory => .ENOMEM,
         else => .ENOSYS,
     };
 }
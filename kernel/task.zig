@@ -4,6 +4,7 @@
 const std = @import("std");
 const platform = @import("platform.zig");
 const util = @import("util.zig");
+const time = @import("time.zig");
 
 const c = @cImport({
     @cInclude("ucontext.h");
@@ -33,9 +34,14 @@ pub const Task = struct {
 
     started: bool = false,
     killed: bool = false,
+    blocked: bool = false, // Skipped by the scheduler until something wakes it
+
+    waiters: ?*Waiter = null, // Every WaitQueue we're registered with, until finishWait()
+    wake_timer: time.Timer = undefined,
 
     entry_point: Task.EntryPoint,
     on_deinit: ?fn (task: *Task) void = null,
+    on_resume: ?fn (task: *Task) void = null, // Runs on the task's own stack each time the scheduler switches back to it
 
     pub fn init(scheduler: *Scheduler, tid: Task.Id, parent_tid: ?Task.Id, entry_point: Task.EntryPoint, stack_size: usize, cookie: Cookie) !*Task {
         var allocator = scheduler.allocator;
@@ -47,6 +53,7 @@ pub const Task = struct {
         errdefer allocator.free(stack_data);
 
         ret.* = Task{ .scheduler = scheduler, .tid = tid, .parent_tid = parent_tid, .entry_point = entry_point, .stack_data = stack_data, .cookie = cookie };
+        ret.wake_timer = time.Timer.init(Task.timerWake, util.asCookie(ret));
         ret.context.uc_stack.ss_sp = @ptrCast(*c_void, stack_data);
         ret.context.uc_stack.ss_size = stack_size;
         c.t_makecontext(&ret.context, Task.entryPoint, @ptrToInt(ret));
@@ -63,6 +70,51 @@ pub const Task = struct {
         self.started = false;
         _ = c.t_getcontext(&self.context);
         if (!self.started) _ = c.t_setcontext(&self.scheduler.context);
+
+        // Back from the scheduler.
+        if (self.on_resume) |on_resume| on_resume(self);
+    }
+
+    // Blocking works in three steps, so that a wakeup can't slip in between checking a condition and going to sleep:
+    //   prepareWait(); register with waitOn(); check the condition; if it isn't met, sleep() and go back to prepareWait().
+    //   Once done, finishWait() unregisters everything.
+
+    pub fn prepareWait(self: *Task) void {
+        @atomicStore(bool, &self.blocked, true, .SeqCst);
+    }
+
+    /// Have `queue` wake us until the next finishWait(). `waiter` must stay valid until then.
+    pub fn waitOn(self: *Task, waiter: *Waiter, queue: *WaitQueue) void {
+        waiter.* = .{ .task = self, .queue = queue, .task_next = self.waiters };
+        self.waiters = waiter;
+        queue.add(waiter);
+    }
+
+    /// Yield until woken by a WaitQueue or until the monotonic clock reaches `deadline`.
+    /// Returns straight away (after one yield) if we were woken since prepareWait().
+    pub fn sleep(self: *Task, deadline: ?i64) void {
+        if (deadline) |when| {
+            if (!self.wake_timer.armed() or self.wake_timer.deadline != when) time.arm(&self.wake_timer, when);
+        }
+        self.yield();
+    }
+
+    pub fn finishWait(self: *Task) void {
+        self.wake();
+        time.cancel(&self.wake_timer);
+        while (self.waiters) |waiter| {
+            self.waiters = waiter.task_next;
+            waiter.queue.remove(waiter);
+        }
+    }
+
+    /// Make a blocked task runnable again. Safe to call from interrupt context.
+    pub fn wake(self: *Task) void {
+        @atomicStore(bool, &self.blocked, false, .SeqCst);
+    }
+
+    fn timerWake(timer: *time.Timer) void {
+        timer.cookie.?.as(Task).wake();
     }
 
     pub fn kill(self: *Task) void {
@@ -75,11 +127,60 @@ pub const Task = struct {
     }
 
     pub fn deinit(self: *Task) void {
+        // Our waiters live on our stack; they must not outlive us in anyone's queue.
+        self.finishWait();
         if (self.on_deinit) |on_deinit| on_deinit(self);
         self.scheduler.allocator.destroy(self);
     }
 };
 
+/// A task's registration with one WaitQueue. See Task.waitOn.
+pub const Waiter = struct {
+    task: *Task,
+    queue: *WaitQueue,
+
+    prev: ?*Waiter = null,
+    next: ?*Waiter = null,
+    task_next: ?*Waiter = null,
+};
+
+/// Tasks waiting for something (e.g. a node becoming readable).
+/// Waking doesn't unregister anyone; tasks stay registered until they call finishWait().
+pub const WaitQueue = struct {
+    head: ?*Waiter = null,
+
+    fn add(self: *WaitQueue, waiter: *Waiter) void {
+        var old_tpl = platform.enterCritical();
+        defer platform.leaveCritical(old_tpl);
+
+        waiter.prev = null;
+        waiter.next = self.head;
+        if (self.head) |head| head.prev = waiter;
+        self.head = waiter;
+    }
+
+    fn remove(self: *WaitQueue, waiter: *Waiter) void {
+        var old_tpl = platform.enterCritical();
+        defer platform.leaveCritical(old_tpl);
+
+        if (waiter.prev) |prev| prev.next = waiter.next else self.head = waiter.next;
+        if (waiter.next) |next| next.prev = waiter.prev;
+        waiter.prev = null;
+        waiter.next = null;
+    }
+
+    /// Safe to call from interrupt context.
+    pub fn wakeAll(self: *WaitQueue) void {
+        var old_tpl = platform.enterCritical();
+        defer platform.leaveCritical(old_tpl);
+
+        var cur = self.head;
+        while (cur) |waiter| : (cur = waiter.next) {
+            waiter.task.wake();
+        }
+    }
+};
+
 pub const Scheduler = struct {
     const TaskList = std.AutoHashMap(Task.Id, *Task);
 
@@ -89,6 +190,7 @@ pub const Scheduler = struct {
 
     context: c.ucontext_t = undefined,
     current_tid: ?Task.Id = undefined,
+    running: ?*Task = null, // The task actually on the CPU; for interrupt handlers, which can't look tasks up
 
     pub fn init(allocator: *std.mem.Allocator) !Scheduler {
         return Scheduler{ .allocator = allocator, .tasks = Scheduler.TaskList.init(allocator), .next_spawn_tid = 0 };
@@ -114,6 +216,14 @@ pub const Scheduler = struct {
         return task;
     }
 
+    /// Whether any task could run right now (i.e. isn't blocked or dead).
+    pub fn hasRunnable(self: *Scheduler) bool {
+        for (self.tasks.items()) |entry| {
+            if (!entry.value.killed and !entry.value.blocked) return true;
+        }
+        return false;
+    }
+
     pub fn loopOnce(self: *Scheduler) void {
         for (self.tasks.items()) |entry| {
             var task = entry.value;
@@ -121,8 +231,11 @@ pub const Scheduler = struct {
 
             task.started = true;
             _ = c.t_getcontext(&self.context);
-            if (!task.killed and task.started)
+            if (!task.killed and !task.blocked and task.started) {
+                self.running = task;
                 _ = c.t_setcontext(&task.context);
+            }
+            self.running = null;
 
             if (task.parent_tid != null and task.parent_tid.? != Task.KernelParentId and self.tasks.get(task.parent_tid.?) == null)
                 task.parent_tid = null;
@@ -1,34 +1,276 @@
 const std = @import("std");
 const platform = @import("platform.zig");
+const util = @import("util.zig");
 
+const Cookie = util.Cookie;
+
+// Clock values as of the last tick. Without a cycle counter, these are all we have.
 var clock: struct {
     real: i64 = 0,
     monotonic: i64 = 0,
     uptime: i64 = 0,
 } = .{};
 
+// Odd while tick() is updating `clock`, and bumped again after, so readers can tell they raced with it.
+var clock_seq: u32 = 0;
+
 var timer_interval: i64 = 0;
 
+// High-resolution source used to interpolate between ticks, if the platform has one we can trust.
+const CycleSource = struct {
+    boot_cycles: u64, // Counter value at monotonic time 0
+    mult: u64, // Nanoseconds per cycle, scaled by 2^cycle_shift
+};
+const cycle_shift = 32;
+var cycles: ?CycleSource = null;
+
 pub fn init() void {
     timer_interval = platform.getTimerInterval();
+    if (platform.cycleCounterHz()) |hz| {
+        cycles = .{ .boot_cycles = platform.readCycleCounter(), .mult = (std.time.ns_per_s << cycle_shift) / hz };
+    }
     clock.real = platform.getTimeNano();
 }
 
-pub fn tick() void {
-    // TODO: probably should use atomics for this
-    _ = @atomicRmw(i64, &clock.real, .Add, timer_interval, .SeqCst);
-    _ = @atomicRmw(i64, &clock.monotonic, .Add, timer_interval, .SeqCst);
-    _ = @atomicRmw(i64, &clock.uptime, .Add, timer_interval, .SeqCst);
+inline fn cycleMonotonic(source: CycleSource) i64 {
+    var count = platform.readCycleCounter() -% source.boot_cycles;
+    return @intCast(i64, (@as(u128, count) * source.mult) >> cycle_shift);
 }
 
+/// Advance the clocks by `elapsed` nanoseconds. Usually one timer interval, but longer after a tickless idle period.
+/// With a cycle counter, `elapsed` is only a hint: the counter knows better how much time really passed.
+pub fn tick(elapsed: i64) void {
+    var delta = if (cycles) |source| cycleMonotonic(source) - clock.monotonic else elapsed;
+
+    _ = @atomicRmw(u32, &clock_seq, .Add, 1, .SeqCst);
+    clock.real += delta;
+    clock.monotonic += delta;
+    clock.uptime += delta;
+    _ = @atomicRmw(u32, &clock_seq, .Add, 1, .SeqCst);
+}
+
+/// Full-resolution reading of `clock_name`.
 pub fn getClockNano(clock_name: anytype) i64 {
-    return @field(clock, @tagName(clock_name));
+    var source = cycles orelse return getClockNanoCoarse(clock_name);
+    while (true) {
+        var seq = @atomicLoad(u32, &clock_seq, .SeqCst);
+        var base = @field(clock, @tagName(clock_name));
+        var base_monotonic = clock.monotonic;
+        if (seq & 1 == 0 and @atomicLoad(u32, &clock_seq, .SeqCst) == seq) {
+            return base + (cycleMonotonic(source) - base_monotonic);
+        }
+    }
+}
+
+/// `clock_name` as of the last tick. Cheaper, but only as precise as `getCoarseResolution()`.
+pub fn getClockNanoCoarse(clock_name: anytype) i64 {
+    while (true) {
+        var seq = @atomicLoad(u32, &clock_seq, .SeqCst);
+        var value = @field(clock, @tagName(clock_name));
+        if (seq & 1 == 0 and @atomicLoad(u32, &clock_seq, .SeqCst) == seq) return value;
+    }
 }
 
 pub fn setClockNano(clock_name: anytype, new_time: i64) void {
-    @field(clock, @tagName(clock_name)) = new_time;
+    var adjust = new_time - getClockNano(clock_name);
+    _ = @atomicRmw(i64, &@field(clock, @tagName(clock_name)), .Add, adjust, .SeqCst);
 }
 
 pub fn getClock(clock_name: anytype) i64 {
     return @divFloor(getClockNano(clock_name), std.time.ns_per_s);
 }
+
+/// Smallest step `getClockNano` can take, in nanoseconds.
+pub fn getResolution() i64 {
+    if (cycles) |source| return std.math.max(1, @intCast(i64, source.mult >> cycle_shift));
+    return timer_interval;
+}
+
+pub fn getCoarseResolution() i64 {
+    return timer_interval;
+}
+
+/// Current value of the monotonic clock, which is what timer deadlines are measured against.
+pub inline fn now() i64 {
+    return getClockNano(.monotonic);
+}
+
+/// A one-shot callback at a point on the monotonic clock.
+/// Callbacks run from the kernel main loop (see `runTimers`), never from interrupt context.
+pub const Timer = struct {
+    pub const Fn = fn (timer: *Timer) void;
+
+    callback: Timer.Fn,
+    cookie: Cookie = null,
+    deadline: i64 = 0,
+
+    expires: u64 = 0, // Deadline in wheel jiffies
+    slot: ?*Slot = null,
+    prev: ?*Timer = null,
+    next: ?*Timer = null,
+
+    pub fn init(callback: Timer.Fn, cookie: Cookie) Timer {
+        return .{ .callback = callback, .cookie = cookie };
+    }
+
+    pub inline fn armed(self: *const Timer) bool {
+        return self.slot != null;
+    }
+};
+
+// Timers live in a hierarchical timing wheel: `num_levels` wheels of `num_slots` slots each, every level
+// `num_slots` times coarser than the one below. Arming and cancelling are O(1) list operations; when the
+// finest wheel wraps, the next level's current slot is "cascaded" down into finer slots.
+
+/// Wheel resolution, in nanoseconds.
+pub const jiffy = std.time.ns_per_ms;
+
+const slot_bits = 6;
+const num_slots = 1 << slot_bits;
+const slot_mask = num_slots - 1;
+const num_levels = 4; // Covers 2^24 jiffies (about 4.6 hours); anything later parks in the last level and cascades again
+
+const Slot = struct {
+    head: ?*Timer = null,
+    level: u8,
+    index: u8,
+};
+
+const Level = struct {
+    slots: [num_slots]Slot,
+    occupied: u64 = 0, // Bit n set if slots[n] is non-empty
+};
+
+var wheel: [num_levels]Level = init_wheel: {
+    var levels: [num_levels]Level = undefined;
+    for (levels) |*level, l| {
+        for (level.slots) |*slot, n| slot.* = .{ .level = l, .index = n };
+        level.occupied = 0;
+    }
+    break :init_wheel levels;
+};
+var wheel_now: u64 = 0; // Next jiffy to be processed
+var timer_count: usize = 0;
+
+inline fn toJiffies(ns: i64) u64 {
+    if (ns <= 0) return 0;
+    return @intCast(u64, @divFloor(ns + jiffy - 1, jiffy));
+}
+
+fn slotFor(expires: u64) *Slot {
+    var delta = if (expires > wheel_now) expires - wheel_now else 0;
+    var level: usize = 0;
+    while (level < num_levels - 1 and delta >= (@as(u64, 1) << @intCast(u6, slot_bits * (level + 1)))) level += 1;
+
+    var shift = @intCast(u6, slot_bits * level);
+    var when = std.math.max(expires, wheel_now);
+    // Too far out even for the coarsest level: park in its furthest slot and get re-sorted when that cascades.
+    if (level == num_levels - 1 and delta >= (@as(u64, 1) << @intCast(u6, slot_bits * num_levels))) when = wheel_now + (@as(u64, slot_mask) << shift);
+    return &wheel[level].slots[@truncate(usize, (when >> shift) & slot_mask)];
+}
+
+fn slotInsert(slot: *Slot, timer: *Timer) void {
+    timer.slot = slot;
+    timer.prev = null;
+    timer.next = slot.head;
+    if (slot.head) |head| head.prev = timer;
+    slot.head = timer;
+    wheel[slot.level].occupied |= @as(u64, 1) << @intCast(u6, slot.index);
+}
+
+/// Fire `timer` once the monotonic clock reaches `deadline`. Re-arming an armed timer moves it.
+pub fn arm(timer: *Timer, deadline: i64) void {
+    if (timer.armed()) cancel(timer);
+
+    timer.deadline = deadline;
+    timer.expires = toJiffies(deadline);
+    slotInsert(slotFor(timer.expires), timer);
+    timer_count += 1;
+}
+
+/// Disarm `timer`. Harmless if it isn't armed.
+pub fn cancel(timer: *Timer) void {
+    var slot = timer.slot orelse return;
+
+    if (timer.prev) |prev| prev.next = timer.next else slot.head = timer.next;
+    if (timer.next) |next| next.prev = timer.prev;
+    if (slot.head == null) wheel[slot.level].occupied &= ~(@as(u64, 1) << @intCast(u6, slot.index));
+
+    timer.slot = null;
+    timer.prev = null;
+    timer.next = null;
+    timer_count -= 1;
+}
+
+// Take every timer out of `slot` at once, leaving it empty.
+fn detach(slot: *Slot) ?*Timer {
+    var list = slot.head;
+    slot.head = null;
+    wheel[slot.level].occupied &= ~(@as(u64, 1) << @intCast(u6, slot.index));
+
+    var cur = list;
+    while (cur) |timer| : (cur = timer.next) {
+        timer.slot = null;
+        timer_count -= 1;
+    }
+    return list;
+}
+
+// Move the timers in `level`'s current slot down to finer levels, cascading further up first if that slot wrapped too.
+fn cascade(level: usize) void {
+    if (level == num_levels) return;
+
+    var index = @truncate(usize, (wheel_now >> @intCast(u6, slot_bits * level)) & slot_mask);
+    if (index == 0) cascade(level + 1);
+
+    var cur = detach(&wheel[level].slots[index]);
+    while (cur) |timer| {
+        cur = timer.next;
+        slotInsert(slotFor(timer.expires), timer);
+        timer_count += 1;
+    }
+}
+
+/// Earliest time at which a timer might need to fire, or null if none are armed.
+/// May be earlier than any real deadline (e.g. when a coarse slot has to be cascaded), never later.
+pub fn nextDeadline() ?i64 {
+    if (timer_count == 0) return null;
+
+    var best: u64 = std.math.maxInt(u64);
+    for (wheel) |level, l| {
+        if (level.occupied == 0) continue;
+        var shift = @intCast(u6, slot_bits * l);
+        var index = @truncate(u6, wheel_now >> shift);
+
+        if (l == 0) {
+            // Level 0 slots map one-to-one onto the next `num_slots` jiffies.
+            best = std.math.min(best, wheel_now + @as(u64, @ctz(u64, std.math.rotr(u64, level.occupied, index))));
+        } else {
+            // Coarser slots are due when they cascade, at the start of their span.
+            var distance = @as(u64, @ctz(u64, std.math.rotr(u64, level.occupied, @as(u7, index) + 1))) + 1;
+            best = std.math.min(best, ((wheel_now >> shift) + distance) << shift);
+        }
+    }
+    return @intCast(i64, std.math.min(best, @intCast(u64, std.math.maxInt(i64)) / jiffy) * jiffy);
+}
+
+/// Fire every timer whose deadline has passed. Called from the kernel main loop once per pass.
+pub fn runTimers() void {
+    var target = @intCast(u64, @divFloor(std.math.max(now(), 0), jiffy));
+    while (wheel_now <= target) {
+        var index = @truncate(usize, wheel_now & slot_mask);
+        if (index == 0) cascade(1);
+
+        // Everything in this slot is due. Pop rather than detach the whole list, so a callback can still cancel the rest.
+        var slot = &wheel[0].slots[index];
+        while (slot.head) |timer| {
+            cancel(timer);
+            timer.callback(timer);
+        }
+
+        // Skip straight over empty slots, stopping at the next wrap so the coarser levels get cascaded.
+        var rest = if (index == slot_mask) 0 else wheel[0].occupied >> @intCast(u6, index + 1);
+        var next = if (rest != 0) wheel_now + 1 + @as(u64, @ctz(u64, rest)) else (wheel_now | slot_mask) + 1;
+        wheel_now = std.math.min(next, target + 1);
+    }
+}
@@ -1,14 +1,17 @@
 const std = @import("std");
 const platform = @import("platform.zig");
 const util = @import("util.zig");
+const idle = @import("idle.zig");
+const task = @import("task.zig");
 
 const Cookie = util.Cookie;
 const RefCount = util.RefCount;
 
 pub const max_name_len = 256;
 pub const max_path_len = 4096;
+pub const page_size = platform.page_size;
 
-pub const Error = error{ NotImplemented, NotDirectory, NotFile, NoSuchFile, FileExists, NotEmpty, ReadFailed, WriteFailed, Again, PathTooLong };
+pub const Error = error{ NotImplemented, NotDirectory, NotFile, NoSuchFile, FileExists, NotEmpty, ReadFailed, WriteFailed, Again, PathTooLong, NameTooLong, FileTooBig, NoSpace };
 
 /// Node represents a FileSystem VNode
 /// There should only be ONE VNode in memory per file at a time!
@@ -106,6 +109,18 @@ pub const Node = struct {
         read: ?fn (self: *Node, offset: u64, buffer: []u8) anyerror!usize = null,
         write: ?fn (self: *Node, offset: u64, buffer: []const u8) anyerror!usize = null,
 
+        // Scatter/gather variants. Drivers that can coalesce (e.g. the console) should provide these;
+        // everyone else gets a loop over read/write.
+        readv: ?fn (self: *Node, offset: u64, buffers: []const []u8) anyerror!usize = null,
+        writev: ?fn (self: *Node, offset: u64, buffers: []const []const u8) anyerror!usize = null,
+        // Set the file's size, dropping whatever lies past it (or leaving a hole when growing).
+        truncate: ?fn (self: *Node, size: u64) anyerror!void = null,
+
+        // Drivers without their own read/write can provide these instead and go through the PageCache.
+        // readPage returns how many bytes of the page are file contents (less than a page only at EOF).
+        readPage: ?fn (self: *Node, index: u64, page: *align(page_size) [page_size]u8) anyerror!usize = null,
+        writePage: ?fn (self: *Node, index: u64, page: *align(page_size) const [page_size]u8, len: usize) anyerror!void = null,
+
         find: ?fn (self: *Node, name: []const u8) anyerror!File = null,
         create: ?fn (self: *Node, name: []const u8, typ: Node.Type, mode: Node.Mode) anyerror!File = null,
         link: ?fn (self: *Node, name: []const u8, other_node: *Node) anyerror!File = null,
@@ -114,6 +129,18 @@ pub const Node = struct {
 
         unlink_me: ?fn (self: *Node) anyerror!void = null,
         free_me: ?fn (self: *Node) void = null,
+
+        // Which of `events` could be done right now without getting Error.Again. Nodes without this are always ready.
+        poll: ?fn (self: *Node, events: Node.PollEvents) Node.PollEvents = null,
+    };
+
+    pub const PollEvents = packed struct {
+        read: bool = false,
+        write: bool = false,
+
+        pub inline fn any(self: PollEvents) bool {
+            return self.read or self.write;
+        }
     };
 
     stat: Stat = .{},
@@ -123,6 +150,8 @@ pub const Node = struct {
     ops: Node.Ops,
     cookie: Cookie = null,
     alt_cookie: ?[]const u8 = null,
+    // Woken whenever poll() might give a different answer. Null if the node never makes anyone wait.
+    wait_queue: ?*task.WaitQueue = null,
 
     pub fn init(ops: Node.Ops, cookie: Cookie, stat: ?Stat, file_system: ?*FileSystem) Node {
         return .{ .ops = ops, .cookie = cookie, .stat = if (stat != null) stat.? else .{}, .file_system = file_system };
@@ -139,6 +168,15 @@ pub const Node = struct {
     }
 
     pub fn close(self: *Node) !void {
+        try self.closeNoUnmount();
+        if (self.file_system) |fs| fs.unref();
+    }
+
+    /// Close without dropping our filesystem's open count, for references that never held it.
+    fn closeNoUnmount(self: *Node) !void {
+        // The driver may free us on last close, so the page cache has to let go first.
+        if (self.opens.refs == 1 and self.ops.readPage != null) try PageCache.release(self);
+
         self.opens.unref();
         if (self.ops.close) |close_fn| {
             close_fn(self) catch |err| {
@@ -146,16 +184,13 @@ pub const Node = struct {
                 return err;
             };
         }
-        if (self.file_system) |fs| {
-            fs.opens.unref();
-            if (fs.opens.refs == 0) fs.deinit();
-        }
     }
 
     pub fn read(self: *Node, offset: u64, buffer: []u8) !usize {
         if (self.ops.read) |read_fn| {
             return try read_fn(self, offset, buffer);
         }
+        if (self.ops.readPage != null) return try PageCache.read(self, offset, buffer);
         return Error.NotImplemented;
     }
 
@@ -163,9 +198,64 @@ pub const Node = struct {
         if (self.ops.write) |write_fn| {
             return try write_fn(self, offset, buffer);
         }
+        if (self.ops.writePage != null) return try PageCache.write(self, offset, buffer);
         return Error.NotImplemented;
     }
 
+    pub fn poll(self: *Node, events: Node.PollEvents) Node.PollEvents {
+        if (self.ops.poll) |poll_fn| {
+            return poll_fn(self, events);
+        }
+        return events;
+    }
+
+    /// Read into each of `buffers` in turn, starting at `offset`. Stops early on a short read.
+    pub fn readv(self: *Node, offset: u64, buffers: []const []u8) !usize {
+        if (self.ops.readv) |readv_fn| {
+            return try readv_fn(self, offset, buffers);
+        }
+
+        var total: usize = 0;
+        for (buffers) |buffer| {
+            // Report what we already have rather than losing it to a later error.
+            var pos = std.math.add(u64, offset, total) catch break;
+            var amount = self.read(pos, buffer) catch |err| if (total > 0) break else return err;
+            total += amount;
+            if (amount < buffer.len) break;
+        }
+        return total;
+    }
+
+    /// Write each of `buffers` in turn, starting at `offset`. Stops early on a short write.
+    pub fn writev(self: *Node, offset: u64, buffers: []const []const u8) !usize {
+        if (self.ops.writev) |writev_fn| {
+            return try writev_fn(self, offset, buffers);
+        }
+
+        var total: usize = 0;
+        for (buffers) |buffer| {
+            var pos = std.math.add(u64, offset, total) catch break;
+            var amount = self.write(pos, buffer) catch |err| if (total > 0) break else return err;
+            total += amount;
+            if (amount < buffer.len) break;
+        }
+        return total;
+    }
+
+    pub fn truncate(self: *Node, size: u64) !void {
+        if (self.ops.truncate) |truncate_fn| {
+            // Cached pages may lie past the new end, so write them back and forget them first.
+            if (self.ops.readPage != null) try PageCache.release(self);
+            return try truncate_fn(self, size);
+        }
+        return Error.NotImplemented;
+    }
+
+    /// Flush any cached writes down to the driver.
+    pub fn sync(self: *Node) !void {
+        if (self.ops.writePage != null) try PageCache.sync(self);
+    }
+
     pub fn find(self: *Node, name: []const u8) !File {
         if (self.ops.find) |find_fn| {
             return try find_fn(self, name);
@@ -175,6 +265,7 @@ pub const Node = struct {
 
     pub fn create(self: *Node, name: []const u8, typ: Node.Type, mode: Node.Mode) !File {
         if (self.ops.create) |create_fn| {
+            DentryCache.invalidate(self, name);
             return try create_fn(self, name, typ, mode);
         }
         return Error.NotImplemented;
@@ -182,6 +273,7 @@ pub const Node = struct {
 
     pub fn link(self: *Node, name: []const u8, new_node: *Node) !File {
         if (self.ops.link) |link_fn| {
+            DentryCache.invalidate(self, name);
             return try link_fn(self, name, new_node);
         }
         return Error.NotImplemented;
@@ -189,6 +281,7 @@ pub const Node = struct {
 
     pub fn unlink(self: *Node, name: []const u8) !void {
         if (self.ops.unlink) |unlink_fn| {
+            DentryCache.invalidate(self, name);
             return try unlink_fn(self, name);
         }
         return Error.NotImplemented;
@@ -203,30 +296,224 @@ pub const Node = struct {
 
     pub fn findRecursive(self: *Node, path: []const u8) !File {
         var path_tokenizer = std.mem.tokenize(path, "/");
-        // FIXME: this will use insane amounts of stack space (64 * (max_name_len = 256))
-        var node_history: [64]File = undefined;
-        var node_history_pos: usize = 0;
 
-        var next_file = File{ .name_ptr = ".", .node = self };
+        // Every node we pass through stays pinned (in the dentry cache) or open (if it couldn't be cached)
+        // until we're done, so nothing gets freed out from under us halfway down the path.
+        var history: [64]DentryCache.Step = undefined;
+        var history_pos: usize = 0;
 
         defer {
-            for (node_history[0..node_history_pos]) |file| {
-                file.node.close() catch {};
+            for (history[0..history_pos]) |step| {
+                step.release();
             }
         }
 
+        var current = self;
+        var last_part: ?[]const u8 = null;
+
         while (true) {
             const part = path_tokenizer.next() orelse break;
             if (std.mem.eql(u8, part, ".")) continue;
             // TODO: the ".." "directory"
-            next_file = try next_file.node.find(part);
-            node_history[node_history_pos] = next_file;
-            node_history_pos += 1;
-            if (node_history_pos == node_history.len) return Error.PathTooLong;
+            if (part.len > max_name_len) return Error.NameTooLong;
+            if (history_pos == history.len) return Error.PathTooLong;
+
+            history[history_pos] = try DentryCache.walk(current, part);
+            current = history[history_pos].node;
+            history_pos += 1;
+            last_part = part;
         }
 
-        if (node_history_pos > 0) node_history_pos -= 1;
-        return next_file;
+        if (last_part) |part| {
+            try current.open();
+            var file = File{ .name_ptr = null, .node = current };
+            std.mem.copy(u8, file.name_buf[0..], part);
+            file.name_len = part.len;
+            return file;
+        }
+        try self.open();
+        return File{ .name_ptr = ".", .node = self };
+    }
+};
+
+/// Kernel-wide cache of directory lookups, keyed by (parent node, name).
+/// Positive entries keep the child open, but don't count towards its filesystem's opens, so a cached
+/// filesystem can still be unmounted; all of its entries are dropped when it is.
+/// Negative entries remember that a name doesn't exist.
+/// Entries are dropped whenever `create`, `link` or `unlink` touches their name.
+pub const DentryCache = struct {
+    /// Longer names are still looked up, just never cached.
+    pub const max_cached_name_len = 48;
+
+    const num_sets = 256;
+    const num_ways = 4;
+
+    const Entry = struct {
+        used: bool = false,
+        negative: bool = false,
+        pins: u32 = 0,
+        last_used: u64 = 0,
+
+        parent: *Node = undefined,
+        parent_fs: ?*FileSystem = null,
+        parent_inode: u64 = 0,
+        child: ?*Node = null,
+
+        hash: u64 = 0,
+        name_len: usize = 0,
+        name_buf: [DentryCache.max_cached_name_len]u8 = undefined,
+
+        fn matches(self: *const Entry, parent: *Node, hash: u64, name: []const u8) bool {
+            // Checking the inode too means a node freed and reallocated at the same address won't match.
+            return self.used and self.hash == hash and self.parent == parent and self.parent_fs == parent.file_system and
+                self.parent_inode == parent.stat.inode and std.mem.eql(u8, self.name_buf[0..self.name_len], name);
+        }
+
+        fn drop(self: *Entry) void {
+            var child = self.child;
+            self.* = .{};
+            if (child) |child_node| {
+                // Borrow a count back for the close to give up; this may be what unmounts the filesystem.
+                if (child_node.file_system) |fs| fs.opens.ref();
+                child_node.close() catch {};
+            }
+        }
+
+        fn belongsTo(self: *const Entry, fs: *FileSystem) bool {
+            if (!self.used) return false;
+            if (self.parent_fs == fs) return true;
+            var child = self.child orelse return false;
+            return child.file_system == fs;
+        }
+    };
+
+    /// A step taken by `walk`. Holds the node in place, and its filesystem mounted, until released.
+    pub const Step = struct {
+        node: *Node,
+        entry: ?*Entry,
+
+        pub fn release(self: Step) void {
+            if (self.entry) |entry| {
+                entry.pins -= 1;
+                if (self.node.file_system) |fs| fs.unref();
+            } else {
+                self.node.close() catch {};
+            }
+        }
+    };
+
+    var sets: [num_sets][num_ways]Entry = [_][num_ways]Entry{[_]Entry{.{}} ** num_ways} ** num_sets;
+    var clock: u64 = 0;
+
+    pub var hits: u64 = 0;
+    pub var misses: u64 = 0;
+
+    inline fn hashName(parent: *Node, name: []const u8) u64 {
+        return std.hash.Wyhash.hash(@ptrToInt(parent), name);
+    }
+
+    inline fn setFor(hash: u64) *[num_ways]Entry {
+        return &sets[@truncate(usize, hash) % num_sets];
+    }
+
+    fn lookup(parent: *Node, hash: u64, name: []const u8) ?*Entry {
+        for (setFor(hash)) |*entry| {
+            if (entry.matches(parent, hash, name)) return entry;
+        }
+        return null;
+    }
+
+    /// Find a free or least recently used unpinned slot. Returns null if every way is pinned.
+    fn victim(hash: u64) ?*Entry {
+        var best: ?*Entry = null;
+        for (setFor(hash)) |*entry| {
+            if (!entry.used) return entry;
+            if (entry.pins > 0) continue;
+            if (best == null or entry.last_used < best.?.last_used) best = entry;
+        }
+        if (best) |entry| entry.drop();
+        return best;
+    }
+
+    fn insert(parent: *Node, hash: u64, name: []const u8, child: ?*Node) ?*Entry {
+        if (name.len > max_cached_name_len) return null;
+        var entry = DentryCache.victim(hash) orelse return null;
+
+        clock += 1;
+        entry.* = .{
+            .used = true,
+            .negative = child == null,
+            .last_used = clock,
+            .parent = parent,
+            .parent_fs = parent.file_system,
+            .parent_inode = parent.stat.inode,
+            .child = child,
+            .hash = hash,
+            .name_len = name.len,
+        };
+        std.mem.copy(u8, entry.name_buf[0..], name);
+        return entry;
+    }
+
+    /// Resolve one path component, going to the driver only on a cache miss.
+    pub fn walk(parent: *Node, name: []const u8) !Step {
+        var hash = DentryCache.hashName(parent, name);
+
+        if (DentryCache.lookup(parent, hash, name)) |entry| {
+            hits += 1;
+            clock += 1;
+            entry.last_used = clock;
+            if (entry.negative) return Error.NoSuchFile;
+            entry.pins += 1;
+            if (entry.child.?.file_system) |fs| fs.opens.ref();
+            return Step{ .node = entry.child.?, .entry = entry };
+        }
+
+        misses += 1;
+        var file = parent.find(name) catch |err| {
+            if (err == Error.NoSuchFile) _ = DentryCache.insert(parent, hash, name, null);
+            return err;
+        };
+
+        // The open reference from find() now belongs to the cache entry, if we got one,
+        // and the filesystem's count it took to the step.
+        if (DentryCache.insert(parent, hash, name, file.node)) |entry| {
+            entry.pins += 1;
+            return Step{ .node = file.node, .entry = entry };
+        }
+        return Step{ .node = file.node, .entry = null };
+    }
+
+    /// Forget whatever we know about `name` in `parent`.
+    pub fn invalidate(parent: *Node, name: []const u8) void {
+        var hash = DentryCache.hashName(parent, name);
+        if (DentryCache.lookup(parent, hash, name)) |entry| {
+            // Lookups never span a yield, so nobody should be holding a pin here.
+            std.debug.assert(entry.pins == 0);
+            entry.drop();
+        }
+    }
+
+    /// Drop everything in or under `fs`, which is being unmounted.
+    fn forgetFileSystem(fs: *FileSystem) void {
+        for (sets) |*set| {
+            for (set) |*entry| {
+                if (!entry.belongsTo(fs)) continue;
+                // Unmounting means nothing can be mid-walk through here.
+                std.debug.assert(entry.pins == 0);
+
+                var child = entry.child;
+                entry.* = .{};
+                if (child) |child_node| {
+                    if (child_node.file_system == fs) {
+                        child_node.closeNoUnmount() catch {};
+                    } else {
+                        if (child_node.file_system) |child_fs| child_fs.opens.ref();
+                        child_node.close() catch {};
+                    }
+                }
+            }
+        }
     }
 };
 
@@ -235,6 +522,12 @@ pub const File = struct {
     name_ptr: ?[]const u8,
     name_buf: [max_name_len]u8 = undefined,
     name_len: usize = 0,
+    // Filled in by readDir(): the offset to pass to resume listing right after this entry.
+    dir_cookie: u64 = 0,
+    // Also filled in by readDir(), so listing a directory doesn't need to open every entry.
+    // Drivers may leave `node` unset in readDir() results.
+    inode: u64 = 0,
+    type: Node.Type = .none,
 
     pub fn name(self: File) []const u8 {
         if (self.name_ptr) |name_str| {
@@ -244,11 +537,294 @@ pub const File = struct {
     }
 };
 
+/// Page cache shared by every driver that implements `readPage`/`writePage` instead of `read`/`write`.
+/// Pages are keyed by (node, page index), read ahead on sequential access, written back lazily
+/// from idle time, and evicted least-recently-used once the global budget is reached.
+pub const PageCache = struct {
+    const Data = [page_size]u8;
+
+    const CachedPage = struct {
+        node: *Node,
+        index: u64,
+        data: *align(page_size) Data,
+        valid: usize = 0, // Bytes of `data` that hold file contents; short at EOF
+        dirty: bool = false,
+        failures: u8 = 0, // Failed background writebacks since the page was last dirtied
+
+        hash_next: ?*CachedPage = null,
+        lru_prev: ?*CachedPage = null,
+        lru_next: ?*CachedPage = null,
+        dirty_prev: ?*CachedPage = null,
+        dirty_next: ?*CachedPage = null,
+    };
+
+    const num_buckets = 1024;
+
+    /// Most pages the cache may hold at once, across all nodes.
+    pub var budget_pages: usize = 2048;
+    /// Pages to read past a miss when access looks sequential.
+    pub var read_ahead_pages: usize = 8;
+    /// Dirty pages written back per idle turn.
+    pub var writeback_batch: usize = 16;
+    /// Failed writebacks after which idle time leaves a page alone until it's written to again.
+    /// It still gets written back by sync and eviction.
+    pub var writeback_max_failures: u8 = 3;
+
+    pub var hits: u64 = 0;
+    pub var misses: u64 = 0;
+
+    var buckets = [_]?*CachedPage{null} ** num_buckets;
+    var lru_head: ?*CachedPage = null; // Most recently used
+    var lru_tail: ?*CachedPage = null;
+    var dirty_head: ?*CachedPage = null;
+    var used_pages: usize = 0;
+
+    var writeback_work = idle.Work.init(PageCache.writebackStep, null);
+
+    inline fn bucketFor(node: *Node, index: u64) *?*CachedPage {
+        var hash = std.hash.Wyhash.hash(@ptrToInt(node), std.mem.asBytes(&index));
+        return &buckets[@truncate(usize, hash) % num_buckets];
+    }
+
+    fn lookup(node: *Node, index: u64) ?*CachedPage {
+        var cur = bucketFor(node, index).*;
+        while (cur) |page| : (cur = page.hash_next) {
+            if (page.node == node and page.index == index) return page;
+        }
+        return null;
+    }
+
+    fn lruUnlink(page: *CachedPage) void {
+        if (page.lru_prev) |prev| prev.lru_next = page.lru_next else lru_head = page.lru_next;
+        if (page.lru_next) |next| next.lru_prev = page.lru_prev else lru_tail = page.lru_prev;
+        page.lru_prev = null;
+        page.lru_next = null;
+    }
+
+    fn lruPush(page: *CachedPage) void {
+        page.lru_next = lru_head;
+        if (lru_head) |head| head.lru_prev = page else lru_tail = page;
+        lru_head = page;
+    }
+
+    fn touch(page: *CachedPage) void {
+        if (lru_head == page) return;
+        PageCache.lruUnlink(page);
+        PageCache.lruPush(page);
+    }
+
+    fn markDirty(page: *CachedPage) void {
+        // New data is worth another try, even if writing this page back has been failing.
+        page.failures = 0;
+        idle.schedule(&writeback_work);
+
+        if (page.dirty) return;
+        page.dirty = true;
+        page.dirty_next = dirty_head;
+        if (dirty_head) |head| head.dirty_prev = page;
+        dirty_head = page;
+    }
+
+    fn clearDirty(page: *CachedPage) void {
+        if (!page.dirty) return;
+        if (page.dirty_prev) |prev| prev.dirty_next = page.dirty_next else dirty_head = page.dirty_next;
+        if (page.dirty_next) |next| next.dirty_prev = page.dirty_prev;
+        page.dirty_prev = null;
+        page.dirty_next = null;
+        page.dirty = false;
+        page.failures = 0;
+    }
+
+    fn writeback(page: *CachedPage) !void {
+        if (!page.dirty) return;
+        var write_page_fn = page.node.ops.writePage orelse return Error.NotImplemented;
+        try write_page_fn(page.node, page.index, page.data, page.valid);
+        PageCache.clearDirty(page);
+    }
+
+    // Unhook a clean page from every list and give its memory back.
+    fn drop(page: *CachedPage) void {
+        std.debug.assert(!page.dirty);
+
+        var link = bucketFor(page.node, page.index);
+        while (link.*) |cur| : (link = &cur.hash_next) {
+            if (cur == page) {
+                link.* = page.hash_next;
+                break;
+            }
+        }
+        PageCache.lruUnlink(page);
+
+        platform.freePages(@ptrCast([*]align(page_size) u8, page.data), 1);
+        platform.heap_allocator.destroy(page);
+        used_pages -= 1;
+    }
+
+    // Make room for one more page, writing back the least recently used dirty pages if we must.
+    fn evictOne() !void {
+        var cur = lru_tail;
+        while (cur) |page| : (cur = page.lru_prev) {
+            PageCache.writeback(page) catch continue;
+            PageCache.drop(page);
+            return;
+        }
+        return error.OutOfMemory;
+    }
+
+    fn insert(node: *Node, index: u64) !*CachedPage {
+        if (used_pages >= budget_pages) try PageCache.evictOne();
+
+        var data = platform.allocPages(1) orelse return error.OutOfMemory;
+        errdefer platform.freePages(data, 1);
+
+        var page = try platform.heap_allocator.create(CachedPage);
+        page.* = .{ .node = node, .index = index, .data = @ptrCast(*align(page_size) Data, data) };
+
+        var bucket = bucketFor(node, index);
+        page.hash_next = bucket.*;
+        bucket.* = page;
+        PageCache.lruPush(page);
+        used_pages += 1;
+        return page;
+    }
+
+    fn fill(node: *Node, index: u64) !*CachedPage {
+        var read_page_fn = node.ops.readPage orelse return Error.NotImplemented;
+
+        var page = try PageCache.insert(node, index);
+        page.valid = read_page_fn(node, index, page.data) catch |err| {
+            PageCache.drop(page);
+            return err;
+        };
+        std.mem.set(u8, page.data[page.valid..], 0);
+        return page;
+    }
+
+    fn get(node: *Node, index: u64) !*CachedPage {
+        if (PageCache.lookup(node, index)) |page| {
+            hits += 1;
+            PageCache.touch(page);
+            return page;
+        }
+
+        misses += 1;
+        var page = try PageCache.fill(node, index);
+
+        // Looks sequential: pull in the next few pages while the device is warm. Only into free budget,
+        // though; evicting for read-ahead could throw out the page we were asked for.
+        if (index == 0 or PageCache.lookup(node, index - 1) != null) {
+            var last_index = (node.stat.size + page_size - 1) / page_size;
+            var ahead = index + 1;
+            while (ahead < last_index and ahead <= index + read_ahead_pages and used_pages < budget_pages) : (ahead += 1) {
+                if (PageCache.lookup(node, ahead) != null) continue;
+                _ = PageCache.fill(node, ahead) catch break;
+            }
+            // Read-ahead may have pushed our page toward the tail; keep it hot.
+            PageCache.touch(page);
+        }
+        return page;
+    }
+
+    pub fn read(node: *Node, offset: u64, buffer: []u8) !usize {
+        if (offset >= node.stat.size) return 0;
+        var end = offset + std.math.min(buffer.len, node.stat.size - offset);
+
+        var pos = offset;
+        while (pos < end) {
+            var page_off = @truncate(usize, pos % page_size);
+            var amount = @truncate(usize, std.math.min(end - pos, page_size - page_off));
+
+            var page = try PageCache.get(node, pos / page_size);
+            std.mem.copy(u8, buffer[@truncate(usize, pos - offset)..][0..amount], page.data[page_off .. page_off + amount]);
+            pos += amount;
+        }
+        return @truncate(usize, end - offset);
+    }
+
+    pub fn write(node: *Node, offset: u64, buffer: []const u8) !usize {
+        var end = std.math.add(u64, offset, buffer.len) catch return Error.FileTooBig;
+
+        var pos = offset;
+        while (pos < end) {
+            var index = pos / page_size;
+            var page_off = @truncate(usize, pos % page_size);
+            var amount = @truncate(usize, std.math.min(end - pos, page_size - page_off));
+
+            var page = PageCache.lookup(node, index) orelse blk: {
+                // Overwriting a whole page, or writing past EOF: nothing worth reading first.
+                if (amount == page_size or index * page_size >= node.stat.size) {
+                    var new_page = try PageCache.insert(node, index);
+                    std.mem.set(u8, new_page.data[0..], 0);
+                    break :blk new_page;
+                }
+                break :blk try PageCache.fill(node, index);
+            };
+            PageCache.touch(page);
+
+            std.mem.copy(u8, page.data[page_off .. page_off + amount], buffer[@truncate(usize, pos - offset)..][0..amount]);
+            if (page_off + amount > page.valid) page.valid = page_off + amount;
+            PageCache.markDirty(page);
+
+            pos += amount;
+            if (pos > node.stat.size) node.stat.size = pos;
+        }
+        return buffer.len;
+    }
+
+    /// Write back every dirty page belonging to `node`.
+    pub fn sync(node: *Node) !void {
+        var cur = dirty_head;
+        while (cur) |page| {
+            cur = page.dirty_next;
+            if (page.node == node) try PageCache.writeback(page);
+        }
+    }
+
+    /// Write back and forget every page belonging to `node`. Called on last close, before the driver can free it.
+    pub fn release(node: *Node) !void {
+        try PageCache.sync(node);
+
+        var cur = lru_head;
+        while (cur) |page| {
+            cur = page.lru_next;
+            if (page.node == node) PageCache.drop(page);
+        }
+    }
+
+    fn writebackStep(work: *idle.Work) bool {
+        var done: usize = 0;
+        var more = false;
+        var cur = dirty_head;
+        while (cur) |page| {
+            cur = page.dirty_next;
+            if (page.failures >= writeback_max_failures) continue;
+            if (done == writeback_batch) return true;
+
+            // On failure the page stays dirty, and we try again on the next turn until it runs out of tries.
+            PageCache.writeback(page) catch {
+                page.failures += 1;
+                if (page.failures < writeback_max_failures) more = true;
+            };
+            done += 1;
+        }
+        // Only pages that keep failing are left (if any), so stop rather than spin on them.
+        return more;
+    }
+};
+
 /// FileSystem defines a FileSystem
 pub const FileSystem = struct {
     pub const Ops = struct {
         mount: fn (self: *FileSystem, device: ?*Node, args: ?[]const u8) anyerror!*Node,
         unmount: ?fn (self: *FileSystem) void = null,
+        stat: ?fn (self: *FileSystem) FileSystem.Stat = null,
+    };
+
+    /// Usage statistics for a mounted FileSystem.
+    pub const Stat = struct {
+        bytes_used: u64 = 0,
+        bytes_limit: ?u64 = null, // null if only bounded by system memory
+        inodes_used: u64 = 0,
     };
 
     name: []const u8,
@@ -258,6 +834,10 @@ pub const FileSystem = struct {
     arena_allocator: std.heap.ArenaAllocator = undefined,
     allocator: *std.mem.Allocator = undefined,
     opens: RefCount = .{},
+    // Tells mounts apart (e.g. as WASI's `dev`). Unique for as long as the kernel runs.
+    dev: u64 = 0,
+
+    var last_dev: u64 = 0;
 
     pub fn init(name: []const u8, ops: FileSystem.Ops) FileSystem {
         return .{ .name = name, .ops = ops };
@@ -273,11 +853,28 @@ pub const FileSystem = struct {
         fs.allocator = &fs.arena_allocator.allocator;
         errdefer fs.arena_allocator.deinit();
 
+        last_dev += 1;
+        fs.dev = last_dev;
+
         return try fs.ops.mount(fs, device, args);
     }
 
+    pub fn stat(self: *FileSystem) FileSystem.Stat {
+        if (self.ops.stat) |stat_fn| {
+            return stat_fn(self);
+        }
+        return .{};
+    }
+
+    /// Give up a reference taken with `opens.ref()`, unmounting on the last one.
+    pub fn unref(self: *FileSystem) void {
+        self.opens.unref();
+        if (self.opens.refs == 0) self.deinit();
+    }
+
     /// You should never call this yourself. unlink() the root node instead.
     pub fn deinit(self: *FileSystem) void {
+        DentryCache.forgetFileSystem(self);
         if (self.ops.unmount) |unmount_fn| {
             unmount_fn(self);
         }
@@ -286,6 +883,32 @@ pub const FileSystem = struct {
     }
 };
 
+/// Everything before the last component of `path` ("" if there is only one).
+pub fn dirname(path: []const u8) []const u8 {
+    var trimmed = std.mem.trimRight(u8, path, "/");
+    var sep = std.mem.lastIndexOfScalar(u8, trimmed, '/') orelse return "";
+    return trimmed[0..sep];
+}
+
+/// The last component of `path`.
+pub fn basename(path: []const u8) []const u8 {
+    var trimmed = std.mem.trimRight(u8, path, "/");
+    var sep = std.mem.lastIndexOfScalar(u8, trimmed, '/') orelse return trimmed;
+    return trimmed[sep + 1 ..];
+}
+
+/// Look up `key` in a mount argument string of the form "key=value,key2=value2".
+/// Returns the value (empty for a bare "key"), or null if the key isn't present.
+pub fn getMountArg(args: ?[]const u8, key: []const u8) ?[]const u8 {
+    var arg_tokenizer = std.mem.tokenize(args orelse return null, ",");
+    while (arg_tokenizer.next()) |arg| {
+        var eq = std.mem.indexOfScalar(u8, arg, '=') orelse arg.len;
+        if (!std.mem.eql(u8, arg[0..eq], key)) continue;
+        return if (eq == arg.len) arg[eq..] else arg[eq + 1 ..];
+    }
+    return null;
+}
+
 /// "/dev/null" type node
 pub const NullNode = struct {
     const ops: Node.Ops = .{
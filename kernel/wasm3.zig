@@ -1,6 +1,5 @@
 const std = @import("std");
 const builtin = @import("builtin");
-const fmt = std.fmt;
 const util = @import("util.zig");
 const platform = @import("platform.zig");
 
@@ -99,7 +98,11 @@ pub const RuntimeStack = struct {
     pub inline fn set(self: RuntimeStack, index: usize, val: anytype) void {
         switch (@TypeOf(val)) {
             u64, u32 => self.stack[index] = @intCast(u64, val),
-            i64, i32 => self.stack[index] = @intCast(u64, val),
+            // Bit patterns, not values: a negative i32 is just its low 32 bits to wasm.
+            i64 => self.stack[index] = @bitCast(u64, val),
+            i32 => self.stack[index] = @bitCast(u32, val),
+            f64 => self.stack[index] = @bitCast(u64, val),
+            f32 => self.stack[index] = @bitCast(u32, val),
             else => @compileError("Invalid type"),
         }
     }
@@ -108,10 +111,11 @@ pub const RuntimeStack = struct {
         return switch (T) {
             u64 => self.stack[index],
             usize => @truncate(usize, self.stack[index] & 0xFFFFFFFF),
-            i64 => @intCast(i64, self.stack[index]),
+            i64 => @bitCast(i64, self.stack[index]), // Negative offsets (fd_seek) must not trap
             u32 => @truncate(u32, self.stack[index] & 0xFFFFFFFF),
             i32 => @truncate(i32, self.stack[index] & 0xFFFFFFFF),
             f64 => (@ptrCast([*]align(1) f64, self.stack))[index],
+            f32 => @bitCast(f32, @truncate(u32, self.stack[index])),
             else => @compileError("Invalid type"),
         };
     }
@@ -158,12 +162,29 @@ fn zigToWasmTypeMulti(comptime T: type, out: []u8) usize {
 
 pub const ZigFunction = fn (ctx: ZigFunctionCtx) anyerror!void;
 
+// wasm3's type codes for a signature character, so linking can compare signatures instead of parsing them.
+fn sigCharToM3Type(ch: u8) u8 {
+    return switch (ch) {
+        'v' => c.c_m3Type_none,
+        'i', '*' => c.c_m3Type_i32,
+        'I' => c.c_m3Type_i64,
+        'f' => c.c_m3Type_f32,
+        'F' => c.c_m3Type_f64,
+        else => unreachable,
+    };
+}
+
 pub const ZigFunctionEx = struct {
     name: [*c]const u8,
     sig: [*c]const u8,
     call: ZigFunction,
     cookie: Cookie = null,
     _orig: fn () void,
+    calls: usize = 0, // Times the guest has called us
+
+    // The signature again, pre-translated for m3_LinkImports.
+    ret_type: u8,
+    arg_types: []const u8,
 
     pub fn init(name: [*c]const u8, f: anytype) ZigFunctionEx {
         comptime var rawftype = @TypeOf(f);
@@ -171,6 +192,8 @@ pub const ZigFunctionEx = struct {
         comptime var fninfo = ftype.Fn;
         comptime var atype = @typeInfo(fninfo.args[1].arg_type.?);
         comptime var sig: [atype.Struct.fields.len * 2 + 2 + 1 + 1]u8 = undefined;
+        comptime var arg_types: [atype.Struct.fields.len * 2]u8 = undefined;
+        comptime var num_args: usize = 0;
         var anonFn = struct {
             pub fn anon(ctx: ZigFunctionCtx) anyerror!void {
                 const args = try ctx.args(fninfo.args[1].arg_type.?);
@@ -179,7 +202,6 @@ pub const ZigFunctionEx = struct {
                 if (@typeInfo(fninfo.return_type.?).ErrorUnion.payload == void) return else ctx.ret(res);
             }
         }.anon;
-        var ret = ZigFunctionEx{ .name = name, .sig = &sig, .call = anonFn, ._orig = @ptrCast(fn () void, f) };
         comptime {
             sig[0] = zigToWasmType(@typeInfo(fninfo.return_type.?).ErrorUnion.payload); // TODO: real thing
             sig[1] = '(';
@@ -189,7 +211,20 @@ pub const ZigFunctionEx = struct {
             }
             sig[i] = ')';
             sig[i + 1] = 0;
+
+            for (sig[2..i]) |ch| {
+                arg_types[num_args] = sigCharToM3Type(ch);
+                num_args += 1;
+            }
         }
+        var ret = ZigFunctionEx{
+            .name = name,
+            .sig = &sig,
+            .call = anonFn,
+            ._orig = @ptrCast(fn () void, f),
+            .ret_type = comptime sigCharToM3Type(sig[0]),
+            .arg_types = arg_types[0..num_args],
+        };
         return ret;
     }
 
@@ -198,7 +233,8 @@ pub const ZigFunctionEx = struct {
             var t = @typeInfo(typ);
             var i = 0;
             for (t.Struct.decls) |decl| {
-                if (std.mem.startsWith(u8, decl.name, prefix))
+                // Private functions are helpers, not host calls.
+                if (decl.is_pub and std.mem.startsWith(u8, decl.name, prefix))
                     i += switch (decl.data) {
                         .Fn => 1,
                         else => 0,
@@ -208,13 +244,28 @@ pub const ZigFunctionEx = struct {
         }
     }
 
+    /// Names of the functions `initMany` would return, in the same order.
+    pub inline fn namesMany(comptime prefix: []const u8, comptime typ: type) [lenInitMany(prefix, typ)][]const u8 {
+        comptime {
+            var ret: [lenInitMany(prefix, typ)][]const u8 = undefined;
+            var i = 0;
+            for (@typeInfo(typ).Struct.decls) |decl| {
+                if (decl.is_pub and std.mem.startsWith(u8, decl.name, prefix) and decl.data == .Fn) {
+                    ret[i] = decl.name[prefix.len..];
+                    i += 1;
+                }
+            }
+            return ret;
+        }
+    }
+
     pub inline fn initMany(comptime prefix: []const u8, comptime s: type) [lenInitMany(prefix, s)]ZigFunctionEx {
         comptime {
             var ret: [lenInitMany(prefix, s)]ZigFunctionEx = undefined;
             var t = @typeInfo(s);
             var i = 0;
             for (t.Struct.decls) |decl| {
-                if (std.mem.startsWith(u8, decl.name, prefix)) {
+                if (decl.is_pub and std.mem.startsWith(u8, decl.name, prefix)) {
                     switch (decl.data) {
                         .Fn => {
                             var name: [decl.name.len - prefix.len + 1:0]u8 = undefined;
@@ -286,22 +337,72 @@ pub const ZigFunctionCtx = struct {
     }
 };
 
+/// A hash over a fixed set of names with no collisions, found at compile time. Lookups are one hash and one compare.
+pub const PerfectHash = struct {
+    seed: u32,
+    slots: []const u16, // Index into the names plus one; zero is an empty slot
+
+    fn hash(seed: u32, name: []const u8) u32 {
+        var h: u32 = 2166136261 ^ seed; // FNV-1a
+        for (name) |ch| h = (h ^ ch) *% 16777619;
+        return h;
+    }
+
+    pub fn build(comptime names: []const []const u8) PerfectHash {
+        comptime {
+            @setEvalBranchQuota(1000000);
+            // Four slots per name keeps the search for a seed short.
+            const size = std.math.ceilPowerOfTwo(usize, std.math.max(names.len, 1) * 4) catch unreachable;
+            var slots: [size]u16 = undefined;
+            var seed: u32 = 0;
+            search: while (true) : (seed += 1) {
+                std.mem.set(u16, slots[0..], 0);
+                for (names) |name, i| {
+                    var slot = hash(seed, name) & (size - 1);
+                    if (slots[slot] != 0) continue :search;
+                    slots[slot] = i + 1;
+                }
+                const final = slots;
+                return PerfectHash{ .seed = seed, .slots = final[0..] };
+            }
+        }
+    }
+
+    /// Where `name` would be, if it's in the set at all; the caller still has to compare.
+    pub inline fn lookup(self: PerfectHash, name: []const u8) ?usize {
+        var slot = self.slots[hash(self.seed, name) & (self.slots.len - 1)];
+        return if (slot == 0) null else slot - 1;
+    }
+};
+
 pub const NativeModule = struct {
     allocator: *std.mem.Allocator,
     functions: []ZigFunctionEx,
+    index: PerfectHash,
 
     pub fn init(allocator: *std.mem.Allocator, comptime prefix: []const u8, impl: type, cookie: anytype) !NativeModule {
-        var ret = NativeModule{ .allocator = allocator, .functions = try allocator.dupe(ZigFunctionEx, ZigFunctionEx.initMany(prefix, impl)[0..]) };
+        const index = comptime PerfectHash.build(ZigFunctionEx.namesMany(prefix, impl)[0..]);
+        var ret = NativeModule{ .allocator = allocator, .functions = try allocator.dupe(ZigFunctionEx, ZigFunctionEx.initMany(prefix, impl)[0..]), .index = index };
         for (ret.functions) |_, i| {
             ret.functions[i].cookie = util.asCookie(cookie);
         }
         return ret;
     }
 
-    pub fn link(self: NativeModule, namespace: [:0]const u8, module: Module) void {
-        for (self.functions) |_, i| {
-            _ = module.linkRawZigFunctionEx(namespace, &self.functions[i]) catch null;
-        }
+    pub fn find(self: *const NativeModule, name: []const u8) ?*const ZigFunctionEx {
+        var f = &self.functions[self.index.lookup(name) orelse return null];
+        return if (std.mem.eql(u8, std.mem.spanZ(f.name), name)) f else null;
+    }
+
+    /// How many times the guest has called any of our functions.
+    pub fn calls(self: *const NativeModule) usize {
+        var total: usize = 0;
+        for (self.functions) |f| total +%= f.calls;
+        return total;
+    }
+
+    pub fn link(self: *const NativeModule, namespace: [:0]const u8, module: Module) !void {
+        return module.linkImports(&[_]ImportBinding{.{ .namespace = namespace, .native = self }});
     }
 
     pub fn deinit(self: NativeModule) void {
@@ -309,6 +410,12 @@ pub const NativeModule = struct {
     }
 };
 
+/// Imports from `namespace` are looked up in `native`.
+pub const ImportBinding = struct {
+    namespace: [:0]const u8,
+    native: *const NativeModule,
+};
+
 pub const Module = struct {
     module: c.IM3Module,
 
@@ -346,6 +453,7 @@ pub const Module = struct {
 
     fn linkZigFunctionHelperEx(runtime: c.IM3Runtime, sp: [*c]u64, mem: ?*c_void, cookie: ?*c_void) callconv(.C) ?*c_void {
         var f: *ZigFunctionEx = @intToPtr(*ZigFunctionEx, @ptrToInt(cookie));
+        f.calls +%= 1;
         var bogusRt = Runtime{ .runtime = runtime, .environ = undefined };
         var mem_slice = @ptrCast([*]u8, mem)[0 .. @intCast(usize, runtime.*.memory.numPages) * 65536];
         f.call(ZigFunctionCtx{ .runtime = bogusRt, .sp = RuntimeStack.init(sp), .memory = mem_slice, .cookie = f.cookie, .trampoline = f }) catch |err| return @intToPtr(*c_void, @ptrToInt(errorToM3Result(err)));
@@ -356,6 +464,50 @@ pub const Module = struct {
         return self.linkRawFunctionEx(modName, f.name, f.sig, Module.linkZigFunctionHelperEx, @intToPtr(*c_void, @ptrToInt(f))); // use stupid casting hack
     }
 
+    fn resolveImport(userdata: ?*c_void, module_name: [*c]const u8, field_name: [*c]const u8, out: [*c]c.M3ImportBinding) callconv(.C) bool {
+        var bindings = @ptrCast(*const []const ImportBinding, @alignCast(@alignOf([]const ImportBinding), userdata)).*;
+        var namespace = std.mem.spanZ(module_name);
+        var name = std.mem.spanZ(field_name);
+        for (bindings) |binding| {
+            if (!std.mem.eql(u8, binding.namespace, namespace)) continue;
+            var f = binding.native.find(name) orelse continue;
+            out.* = .{
+                .function = Module.linkZigFunctionHelperEx,
+                .cookie = @intToPtr(*c_void, @ptrToInt(f)),
+                .returnType = f.ret_type,
+                .numArgs = @intCast(u8, f.arg_types.len),
+                .argTypes = f.arg_types.ptr,
+            };
+            return true;
+        }
+        return false;
+    }
+
+    /// Link every import this module has against `bindings`, in one pass over the imports.
+    pub fn linkImports(self: Module, bindings: []const ImportBinding) !void {
+        return m3ResultToError(c.m3_LinkImports(self.module, Module.resolveImport, @intToPtr(*c_void, @ptrToInt(&bindings))), void);
+    }
+
+    pub const CompileStep = struct {
+        wasm_bytes: u32, // Bytecode compiled this step; 0 if the runtime was busy compiling already
+        more: bool,
+    };
+
+    /// Compile one function ahead of the first call to it, in call-graph order. Meant to be called repeatedly
+    /// from idle time until `more` comes back false.
+    pub fn compileAhead(self: Module) !CompileStep {
+        var ret = CompileStep{ .wasm_bytes = 0, .more = false };
+        try m3ResultToError(c.m3_CompileAhead(self.module, &ret.wasm_bytes, &ret.more), void);
+        return ret;
+    }
+
+    /// Capture the module's memory, globals and table as they are now, for Runtime.parseAndLoadModuleFromSnapshot.
+    pub fn snapshot(self: Module) !Snapshot {
+        var ret: Snapshot = undefined;
+        try m3ResultToError(c.m3_TakeSnapshot(self.module, &ret.raw), void);
+        return ret;
+    }
+
     pub fn destroy(self: Module) void {
         c.m3_FreeModule(self.module);
     }
@@ -366,6 +518,16 @@ pub const Module = struct {
     }
 };
 
+/// A bare reference to a function, without its runtime. Cheap enough to collect from interrupt context.
+pub const FunctionRef = *const c.M3Function;
+
+/// The function's name, or `func[N]` if the module doesn't give it one.
+pub fn functionRefName(func: FunctionRef, buf: []u8) []const u8 {
+    if (func.name != null) return std.mem.spanZ(func.name);
+    var index = (@ptrToInt(func) - @ptrToInt(func.module.*.functions)) / @sizeOf(c.M3Function);
+    return std.fmt.bufPrint(buf, "func[{}]", .{index}) catch "func[?]";
+}
+
 pub const Function = struct {
     func: ?*c.M3Function,
     runtime: Runtime,
@@ -396,30 +558,157 @@ pub const Function = struct {
         return self.runtime.stack().get(T, 0);
     }
 
+    /// Call with arguments written straight onto the wasm stack. The argument and result types are checked
+    /// against the function's signature on every call; bind a `TypedFunction` to check once instead.
+    /// Literals take whichever type of their kind the function declares, so `f.call(i32, .{5})` works for an i32 or i64 parameter.
     pub fn call(self: Function, comptime T: type, args: anytype) !T {
-        comptime var tInfo = @typeInfo(@TypeOf(args));
-        var trueArgs: [tInfo.Struct.fields.len][32]u8 = undefined;
-        var cArgs: [tInfo.Struct.fields.len + 1][*c]u8 = undefined;
-        inline for (tInfo.Struct.fields) |field, i| {
-            switch (@typeInfo(field.field_type)) {
-                .ComptimeInt, .Int => try fmt.bufPrint(trueArgs[i][0..], "{d}\x00", .{@field(args, field.name)}),
-                .ComptimeFloat => {
-                    {
-                        var rtFloat: f64 = @field(args, field.name);
-                        _ = try fmt.bufPrint(trueArgs[i][0..], "{d}\x00", .{@ptrCast([*]u64, &rtFloat)[0]});
-                    }
+        const fields = @typeInfo(@TypeOf(args)).Struct.fields;
+        var ftype = self.func.?.funcType;
+        if (ftype.*.returnType != m3TypeOf(T) or ftype.*.numArgs != fields.len) return Error.InvalidType;
+        // argTypes is declared with a placeholder length; the real one is numArgs.
+        var arg_types = @ptrCast([*]const u8, &ftype.*.argTypes);
+
+        var sp = self.runtime.stack();
+        inline for (fields) |field, i| {
+            const value = @field(args, field.name);
+            switch (field.field_type) {
+                comptime_int => switch (arg_types[i]) {
+                    c.c_m3Type_i32 => sp.set(i, std.math.cast(i32, @as(i64, value)) catch return Error.InvalidType),
+                    c.c_m3Type_i64 => sp.set(i, @as(i64, value)),
+                    else => return Error.InvalidType,
                 },
-                .Float => switch (@typeInfo(field.field_type).Float.bits) {
-                    64 => _ = try fmt.bufPrint(trueArgs[i][0..], "{d}\x00", .{@ptrCast([*]u64, &@field(args, field.name))[0]}),
-                    32 => _ = try fmt.bufPrint(trueArgs[i][0..], "{d}\x00", .{@ptrCast([*]u32, &@field(args, field.name))[0]}),
-                    else => @compileError("Invalid float type"),
+                comptime_float => switch (arg_types[i]) {
+                    c.c_m3Type_f32 => sp.set(i, @as(f32, value)),
+                    c.c_m3Type_f64 => sp.set(i, @as(f64, value)),
+                    else => return Error.InvalidType,
                 },
-                else => @compileError("Invalid argument type"),
+                else => {
+                    if (arg_types[i] != m3TypeOf(field.field_type)) return Error.InvalidType;
+                    sp.set(i, value);
+                },
+            }
+        }
+        return self.callPrepared(T);
+    }
+
+    /// Bind to a Zig function type, e.g. `fn (i32, f64) i64`. The signature is checked here, once;
+    /// after that, calls through the result only need the argument types to match at compile time.
+    pub fn typed(self: Function, comptime F: type) !TypedFunction(F) {
+        const Typed = TypedFunction(F);
+        if (!self.matches(comptime wasmSignature(@typeInfo(F).Fn.return_type.?, Typed.arg_types[0..]))) return Error.InvalidType;
+        return Typed{ .function = self };
+    }
+
+    fn matches(self: Function, comptime sig: []const u8) bool {
+        var ftype = self.func.?.funcType;
+        if (ftype.*.returnType != sig[0] or ftype.*.numArgs != sig.len - 1) return false;
+        // argTypes is declared with a placeholder length; the real one is numArgs.
+        var arg_types = @ptrCast([*]const u8, &ftype.*.argTypes);
+        for (sig[1..]) |typ, i| {
+            if (arg_types[i] != typ) return false;
+        }
+        return true;
+    }
+
+    fn callUnchecked(self: Function, comptime T: type, comptime types: []const type, args: anytype) !T {
+        var sp = self.runtime.stack();
+        inline for (@typeInfo(@TypeOf(args)).Struct.fields) |field, i| {
+            sp.set(i, @as(types[i], @field(args, field.name)));
+        }
+        return self.callPrepared(T);
+    }
+
+    // Run the function on the arguments already on the stack.
+    fn callPrepared(self: Function, comptime T: type) !T {
+        var res = c.m3_CallPrepared(self.func);
+        if (res != null) return m3ResultToError(res, T);
+        comptime if (T == void) return;
+        return self.runtime.stack().get(T, 0);
+    }
+};
+
+/// A `Function` whose signature has already been checked against `F`. See `Function.typed`.
+pub fn TypedFunction(comptime F: type) type {
+    const info = @typeInfo(F).Fn;
+    return struct {
+        const Self = @This();
+        pub const Signature = F;
+
+        function: Function,
+
+        const arg_types = comptime blk: {
+            var types: [info.args.len]type = undefined;
+            for (info.args) |arg, i| types[i] = arg.arg_type.?;
+            break :blk types;
+        };
+
+        pub fn call(self: Self, args: anytype) !info.return_type.? {
+            const fields = @typeInfo(@TypeOf(args)).Struct.fields;
+            comptime {
+                if (fields.len != arg_types.len) @compileError("Wrong number of arguments");
+                for (fields) |field, i| {
+                    if (!accepts(arg_types[i], field.field_type)) @compileError("Argument " ++ field.name ++ " has the wrong type");
+                }
             }
-            cArgs[i] = &trueArgs[i];
+            return self.function.callUnchecked(info.return_type.?, arg_types[0..], args);
         }
-        cArgs[tInfo.Struct.fields.len] = @intToPtr([*c]u8, 0);
-        return self.callWithArgs(T, &cArgs, tInfo.Struct.fields.len);
+    };
+}
+
+// Literals fit any parameter of their kind; everything else has to match exactly.
+fn accepts(comptime Param: type, comptime Arg: type) bool {
+    return switch (Arg) {
+        comptime_int => @typeInfo(Param) == .Int,
+        comptime_float => @typeInfo(Param) == .Float,
+        else => Arg == Param,
+    };
+}
+
+fn m3TypeOf(comptime T: type) u8 {
+    return switch (T) {
+        void => c.c_m3Type_none,
+        u32, i32 => c.c_m3Type_i32,
+        u64, i64 => c.c_m3Type_i64,
+        f32 => c.c_m3Type_f32,
+        f64 => c.c_m3Type_f64,
+        else => @compileError("Invalid type"),
+    };
+}
+
+/// Return type first, then the arguments, as wasm3 type codes.
+fn wasmSignature(comptime Ret: type, comptime args: []const type) []const u8 {
+    comptime {
+        var sig: [args.len + 1]u8 = undefined;
+        sig[0] = m3TypeOf(Ret);
+        for (args) |arg, i| sig[i + 1] = m3TypeOf(arg);
+        return sig[0..];
+    }
+}
+
+// Every runtime shares one environment, so the code pages a process leaves behind go to the next one
+// instead of back to the heap.
+var shared_environ: c.IM3Environment = null;
+
+fn sharedEnvironment() !c.IM3Environment {
+    if (shared_environ == null) {
+        shared_environ = c.m3_NewEnvironment();
+        if (shared_environ == null) return Error.CantCreateEnv;
+    }
+    return shared_environ;
+}
+
+pub const CodePageInfo = c.M3CodePageInfo;
+
+pub const Snapshot = struct {
+    raw: c.M3Snapshot,
+
+    /// Bytes held by the snapshot, near enough.
+    pub fn size(self: *const Snapshot) usize {
+        return self.raw.memorySize + self.raw.numGlobals * @sizeOf(u64) + self.raw.tableSize * @sizeOf(u32);
+    }
+
+    pub fn deinit(self: *Snapshot) void {
+        c.m3_FreeSnapshot(&self.raw);
     }
 };
 
@@ -429,9 +718,7 @@ pub const Runtime = struct {
 
     pub fn init(stackBytes: usize) !Runtime {
         var ret: Runtime = undefined;
-        ret.environ = c.m3_NewEnvironment();
-        if (ret.environ == null) return Error.CantCreateEnv;
-        errdefer c.m3_FreeEnvironment(ret.environ);
+        ret.environ = try sharedEnvironment();
         ret.runtime = c.m3_NewRuntime(ret.environ, @intCast(u32, stackBytes), null);
         if (ret.runtime == null) return Error.CantCreateRuntime;
         errdefer c.m3_FreeRuntime(ret.environ);
@@ -451,6 +738,20 @@ pub const Runtime = struct {
         return Module.init(modPtr);
     }
 
+    /// Like parseAndLoadModule, but the module's memory, globals and table come from `snapshot` instead of being
+    /// initialised, and its start function doesn't run. `data` has to be the image the snapshot was taken from.
+    pub fn parseAndLoadModuleFromSnapshot(self: Runtime, data: []const u8, snapshot: *const Snapshot) !Module {
+        var modPtr: c.IM3Module = undefined;
+        var res = c.m3_ParseModule(self.environ, &modPtr, data.ptr, @intCast(u32, data.len));
+        if (res != null) return m3ResultToError(res, Module);
+        errdefer {
+            c.m3_FreeModule(modPtr);
+        }
+        res = c.m3_LoadModuleFromSnapshot(self.runtime, modPtr, &snapshot.raw);
+        if (res != null) return m3ResultToError(res, Module);
+        return Module.init(modPtr);
+    }
+
     pub fn findFunction(self: Runtime, name: [*c]const u8) !Function {
         var rawf: c.IM3Function = undefined;
         var res = c.m3_FindFunction(&rawf, self.runtime, name);
@@ -458,13 +759,57 @@ pub const Runtime = struct {
         return Function.init(rawf, self);
     }
 
+    /// Look up a whole set of exports at once. Every field of `T` is a `Function` or a `TypedFunction`, found by its
+    /// name; keep the result around rather than looking functions up again on every call.
+    pub fn bindExports(self: Runtime, comptime T: type) !T {
+        var ret: T = undefined;
+        inline for (@typeInfo(T).Struct.fields) |field| {
+            const name = field.name ++ "\x00";
+            var function = try self.findFunction(name);
+            @field(ret, field.name) = if (field.field_type == Function) function else try function.typed(field.field_type.Signature);
+        }
+        return ret;
+    }
+
+    /// Start or stop keeping the chain of executing functions that `callStack` walks. It costs every call
+    /// a little, so it's off until someone wants to sample.
+    pub fn setRecordCallStack(self: Runtime, enabled: bool) void {
+        self.runtime.?.tailCall = false; // Nothing consumes it while we aren't recording
+        self.runtime.?.recordCallStack = enabled;
+    }
+
+    /// The wasm functions executing right now, innermost first, as many as fit in `buf`.
+    /// Safe to call from interrupt context. Empty unless recording was turned on with `setRecordCallStack`.
+    pub fn callStack(self: Runtime, buf: []FunctionRef) []FunctionRef {
+        var n: usize = 0;
+        var frame = self.runtime.?.callStack;
+        while (frame != null and n < buf.len) : (frame = frame.*.caller) {
+            buf[n] = frame.*.function;
+            n += 1;
+        }
+        return buf[0..n];
+    }
+
+    /// The guest's linear memory as it stands right now. Invalidated by memory.grow.
+    pub fn memory(self: Runtime) []u8 {
+        var header = self.runtime.?.memory.mallocated;
+        if (header == null) return &[_]u8{};
+        return @ptrCast([*]u8, header)[@sizeOf(c.M3MemoryHeader)..][0..header.*.length];
+    }
+
     pub inline fn stack(self: Runtime) RuntimeStack {
         var rawstack = @ptrCast([*]u64, @alignCast(@alignOf([*]u64), self.runtime.?.stack));
         return RuntimeStack.init(rawstack);
     }
 
+    /// How much of its code pages this runtime uses, and how much the shared pool holds.
+    pub fn codePageInfo(self: Runtime) CodePageInfo {
+        var info: CodePageInfo = undefined;
+        c.m3_GetCodePageInfo(self.runtime, &info);
+        return info;
+    }
+
     pub fn deinit(self: Runtime) void {
         c.m3_FreeRuntime(self.runtime);
-        c.m3_FreeEnvironment(self.environ);
     }
 };
@@ -120,7 +120,8 @@ M3Result  ValidateSignature  (IM3Function i_function, ccstr_t i_linkingSignature
     IM3FuncType ftype = NULL;
 _   (SignatureToFuncType (& ftype, i_linkingSignature));
 
-    if (not AreFuncTypesEqual (ftype, i_function->funcType))
+    // Only look it up: a one-off signature shouldn't stay interned after we're done comparing
+    if (FindFuncType (ftype->returnType, ftype->numArgs, ftype->argTypes) != i_function->funcType)
     {
         m3log (module, "expected: %s", SPrintFuncTypeSignature (ftype));
         m3log (module, "   found: %s", SPrintFuncTypeSignature (i_function->funcType));
@@ -230,12 +231,10 @@ IM3Function  FindFunction    (IM3Module       io_module,
     return NULL;
 }
 
-M3Result  LinkRawFunctionEx  (IM3Module io_module,  IM3Function io_function, ccstr_t signature,  const void * i_function, void * cookie)
+static
+M3Result  EmitRawCallEx  (IM3Module io_module,  IM3Function io_function, const void * i_function, void * cookie)
 {
-    M3Result result = m3Err_none;                                                 d_m3Assert (io_module->runtime);
-
-_try {
-_   (ValidateSignature (io_function, signature));
+    M3Result result = m3Err_none;
 
     IM3CodePage page = AcquireCodePageWithCapacity (io_module->runtime, 3);
 
@@ -250,12 +249,56 @@ _   (ValidateSignature (io_function, signature));
 
         ReleaseCodePage (io_module->runtime, page);
     }
-    else _throw(m3Err_mallocFailedCodePage);
+    else result = m3Err_mallocFailedCodePage;
+
+    return result;
+}
+
+M3Result  LinkRawFunctionEx  (IM3Module io_module,  IM3Function io_function, ccstr_t signature,  const void * i_function, void * cookie)
+{
+    M3Result result = m3Err_none;                                                 d_m3Assert (io_module->runtime);
 
+_try {
+_   (ValidateSignature (io_function, signature));
+_   (EmitRawCallEx (io_module, io_function, i_function, cookie));
 } _catch:
     return result;
 }
 
+static
+bool  BindingMatchesFuncType  (const M3ImportBinding * i_binding, IM3FuncType i_type)
+{
+    // A signature nobody has declared can't be the one the import wants
+    return FindFuncType (i_binding->returnType, i_binding->numArgs, i_binding->argTypes) == i_type;
+}
+
+M3Result  m3_LinkImports  (IM3Module io_module, M3ImportResolver i_resolver, void * i_userdata)
+{
+    M3Result result = m3Err_none;                                                 d_m3Assert (io_module->runtime);
+
+    for (u32 i = 0; i < io_module->numFunctions; ++i)
+    {
+        IM3Function f = & io_module->functions [i];
+
+        if (not f->import.moduleUtf8 or not f->import.fieldUtf8 or f->compiled)
+            continue;
+
+        M3ImportBinding binding;
+        if (not i_resolver (i_userdata, f->import.moduleUtf8, f->import.fieldUtf8, & binding))
+            continue;
+
+        if (not BindingMatchesFuncType (& binding, f->funcType))
+        {
+            m3log (module, "signature mismatch linking %s.%s", f->import.moduleUtf8, f->import.fieldUtf8);
+            continue;
+        }
+
+_       (EmitRawCallEx (io_module, f, (voidptr_t) binding.function, binding.cookie));
+    }
+
+    _catch: return result;
+}
+
 M3Result  m3_LinkRawFunctionEx  (IM3Module            io_module,
                                 const char * const    i_moduleName,
                                 const char * const    i_functionName,
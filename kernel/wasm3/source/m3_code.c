@@ -55,6 +55,12 @@ u32  NumFreeLines  (IM3CodePage i_page)
 }
 
 
+u32  GetCodePageNumBytes  (IM3CodePage i_page)
+{
+    return sizeof (M3CodePageHeader) + sizeof (code_t) * i_page->info.numLines;
+}
+
+
 void  EmitWord_impl  (IM3CodePage i_page, void * i_word)
 {                                                                       d_m3Assert (i_page->info.lineIndex+1 <= i_page->info.numLines);
     i_page->code [i_page->info.lineIndex++] = i_word;
@@ -56,11 +56,12 @@ static const u16 c_m3RegisterUnallocated = 0;
 static const u16 c_slotUnused = 0xffff;
 
 
-M3Result  AcquireCompilationCodePage  (IM3Compilation o, IM3CodePage * o_codePage)
+static
+M3Result  AcquireCompilationCodePageWithCapacity  (IM3Compilation o, IM3CodePage * o_codePage, u32 i_minNumLines)
 {
     M3Result result = m3Err_none;
 
-    IM3CodePage page = AcquireCodePage (o->runtime);
+    IM3CodePage page = AcquireCodePageForModule (o->runtime, o->module, i_minNumLines);
 
     if (page)
     {
@@ -87,6 +88,11 @@ _               (m3ReallocArray (& func->codePageRefs, IM3CodePage, func->numCod
     return result;
 }
 
+M3Result  AcquireCompilationCodePage  (IM3Compilation o, IM3CodePage * o_codePage)
+{
+    return AcquireCompilationCodePageWithCapacity (o, o_codePage, d_m3CodePageFreeLinesThreshold);
+}
+
 void  ReleaseCompilationCodePage  (IM3Compilation o)
 {
     ReleaseCodePage (o->runtime, o->page);
@@ -1063,6 +1069,22 @@ _   (ReadLEB_u32 (& localIndex, & o->wasm, o->wasmEnd));             //  printf
 
     if (localIndex < GetFunctionNumArgsAndLocals (o->function))
     {
+#if d_m3CoalesceLocalSetGet
+        // local.set X immediately followed by local.get X is a local.tee X: the value can stay where it is
+        // (often _r0) instead of being read straight back out of the local's slot.
+        if (i_opcode == c_waOp_setLocal and o->wasm < o->wasmEnd and * o->wasm == c_waOp_getLocal)
+        {
+            bytes_t next = o->wasm + 1;
+            u32 nextIndex;
+
+            if (ReadLEB_u32 (& nextIndex, & next, o->wasmEnd) == m3Err_none and nextIndex == localIndex)
+            {                                                                   m3log (compile, d_indent "%s(local.set/get %d coalesced into local.tee)", get_indention_string (o), localIndex);
+                o->wasm = next;
+                i_opcode = c_waOp_teeLocal;
+            }
+        }
+#endif
+
         u16 localSlot = GetSlotForStackIndex (o, localIndex);
 
         u16 preserveSlot;
@@ -1343,7 +1365,8 @@ void  AlignSlotIndexToType  (u16 * io_slotIndex, u8 i_type)
 }
 
 
-M3Result  CompileCallArgsAndReturn  (IM3Compilation o, u16 * o_stackOffset, IM3FuncType i_type, bool i_isIndirect)
+// For a tail call (i_isTailCall) the callee's result becomes ours, so nothing is pushed for it.
+M3Result  CompileCallArgsAndReturn  (IM3Compilation o, u16 * o_stackOffset, IM3FuncType i_type, bool i_isIndirect, bool i_isTailCall)
 {
     M3Result result = m3Err_none;
 
@@ -1380,7 +1403,7 @@ _       (Pop (o));
 
     i32 numReturns = i_type->returnType ? 1 : 0;
 
-    if (numReturns)
+    if (numReturns and not i_isTailCall)
     {
         MarkSlotAllocated (o, topSlot);
 _       (Push (o, i_type->returnType, topSlot));
@@ -1405,28 +1428,41 @@ _   (ReadLEB_u32 (& functionIndex, & o->wasm, o->wasmEnd));
                                                                                 get_indention_string (o), GetFunctionName (function), function->funcType->numArgs);
         if (function->module)
         {
+            bool isTailCall = (i_opcode == c_waOp_returnCall);
+
+            if (isTailCall)
+                _throwif ("return_call result type mismatch", function->funcType->returnType != GetFunctionReturnType (o->function));
+
             // OPTZ: could avoid arg copy when args are already sequential and at top
 
             u16 slotTop;
-_           (CompileCallArgsAndReturn (o, & slotTop, function->funcType, false));
+_           (CompileCallArgsAndReturn (o, & slotTop, function->funcType, false, isTailCall));
 
             IM3Operation op;
             const void * operand;
 
             if (function->compiled)
             {
-                op = op_Call;
+                op = isTailCall ? op_ReturnCall : op_Call;
                 operand = function->compiled;
             }
             else
             {                                                           d_m3Assert (function->module);  // not linked
-                op = op_Compile;
+                op = isTailCall ? op_ReturnCompile : op_Compile;
                 operand = function;
+
+                Module_QueueForCompile (function->module, function);
             }
 
 _           (EmitOp     (o, op));
             EmitPointer (o, operand);
             EmitSlotOffset  (o, slotTop);
+
+            if (isTailCall)
+            {
+                EmitConstant32 (o, function->funcType->numArgs * (sizeof (u64) / sizeof (m3slot_t)));
+                o->block.isPolymorphic = true;
+            }
         }
         else
         {
@@ -1457,16 +1493,27 @@ _       (PreserveRegisterIfOccupied (o, c_m3Type_i32));
 
     u16 tableIndexSlot = GetStackTopSlotIndex (o);
 
-    u16 execTop;
     IM3FuncType type = o->module->funcTypes [typeIndex];
-_   (CompileCallArgsAndReturn (o, & execTop, type, true));
+    bool isTailCall = (i_opcode == c_waOp_returnCallIndirect);
+
+    if (isTailCall)
+        _throwif ("return_call_indirect result type mismatch", type->returnType != GetFunctionReturnType (o->function));
+
+    u16 execTop;
+_   (CompileCallArgsAndReturn (o, & execTop, type, true, isTailCall));
 
-_   (EmitOp         (o, op_CallIndirect));
+_   (EmitOp         (o, isTailCall ? op_ReturnCallIndirect : op_CallIndirect));
     EmitSlotOffset  (o, tableIndexSlot);
     EmitPointer     (o, o->module);
-    EmitPointer     (o, type);              // TODO: unify all types in M3Environment
+    EmitPointer     (o, type);              // interned, so the check at runtime is a pointer compare
     EmitSlotOffset  (o, execTop);
 
+    if (isTailCall)
+    {
+        EmitConstant32 (o, type->numArgs * (sizeof (u64) / sizeof (m3slot_t)));
+        o->block.isPolymorphic = true;
+    }
+
 } _catch:
     return result;
 }
@@ -1902,8 +1949,8 @@ const M3OpInfo c_operations [] =
     M3OP( "return",              0, any,    d_logOp (Return),                   Compile_Return ),       // 0x0f
     M3OP( "call",                0, any,    d_logOp (Call),                     Compile_Call ),         // 0x10
     M3OP( "call_indirect",       0, any,    d_logOp (CallIndirect),             Compile_CallIndirect ), // 0x11
-    M3OP( "return_call",         0, any,    d_emptyOpList,                      Compile_Call ),         // 0x12 TODO: Optimize
-    M3OP( "return_call_indirect",0, any,    d_emptyOpList,                      Compile_CallIndirect ), // 0x13
+    M3OP( "return_call",         0, none,   d_logOp (ReturnCall),               Compile_Call ),         // 0x12
+    M3OP( "return_call_indirect",0, none,   d_logOp (ReturnCallIndirect),       Compile_CallIndirect ), // 0x13
 
     M3OP_RESERVED,  M3OP_RESERVED,                                                                      // 0x14 - 0x15
     M3OP_RESERVED,  M3OP_RESERVED, M3OP_RESERVED, M3OP_RESERVED,                                        // 0x16 - 0x19
@@ -2338,6 +2385,7 @@ M3Result  Compile_Function  (IM3Function io_function)
 
     IM3Compilation o = & runtime->compilation;
     SetupCompilation (o);
+    runtime->compiling = true;
 
     o->runtime  = runtime;
     o->module   = io_function->module;
@@ -2346,7 +2394,11 @@ M3Result  Compile_Function  (IM3Function io_function)
     o->wasmEnd  = io_function->wasmEnd;
 
 _try {
-_   (AcquireCompilationCodePage (o, & o->page));
+    // Start on a page with room for the whole function (by estimate), so its code doesn't get split by bridges
+    u32 wasmBytes = (u32) (io_function->wasmEnd - io_function->wasm);
+    u32 estimatedLines = M3_MIN (wasmBytes * d_m3CodeLinesPerWasmByte, d_m3CodeArenaMaxBytes / sizeof (code_t));
+
+_   (AcquireCompilationCodePageWithCapacity (o, & o->page, estimatedLines + d_m3CodePageFreeLinesThreshold));
 
     pc_t pc = GetPagePC (o->page);
 
@@ -2398,8 +2450,6 @@ _   (EmitOp (o, op_Entry));
 
 _   (Compile_BlockStatements (o));
 
-    io_function->compiled = pc;
-
     u32 numConstantSlots = o->maxConstSlotIndex - o->firstConstSlotIndex;       m3log (compile, "unique constant slots: %d; unused slots: %d", numConstantSlots, o->firstDynamicSlotIndex - o->maxConstSlotIndex);
 
     io_function->numConstantBytes = numConstantSlots * sizeof (m3slot_t);
@@ -2409,9 +2459,17 @@ _   (Compile_BlockStatements (o));
 _       (m3CopyMem (& io_function->constants, o->constants, io_function->numConstantBytes));
     }
 
+    // Publish last, in one store: a call site or table entry that sees compiled set may jump straight in,
+    // and with idle-time compilation the function can be finished while its caller is suspended mid-op.
+    __atomic_store_n (& io_function->compiled, pc, __ATOMIC_RELEASE);
+
+    if (io_function->queuedForCompile)
+        o->module->numQueuedBytes -= M3_MIN (o->module->numQueuedBytes, wasmBytes);
+
 } _catch:
 
     ReleaseCompilationCodePage (o);
+    runtime->compiling = false;
 
     return result;
 }
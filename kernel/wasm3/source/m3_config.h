@@ -16,6 +16,18 @@
 #   define d_m3CodePageAlignSize                4096
 # endif
 
+# ifndef d_m3CodeLinesPerWasmByte
+#   define d_m3CodeLinesPerWasmByte             2       // rough metacode size of a byte of function body; sizes code pages up front
+# endif
+
+# ifndef d_m3CodeArenaMaxBytes
+#   define d_m3CodeArenaMaxBytes                (64*1024)   // largest page allocated up front for a module's not-yet-compiled functions
+# endif
+
+# ifndef d_m3CodePagePoolMaxBytes
+#   define d_m3CodePagePoolMaxBytes             (1024*1024) // released pages an environment keeps for reuse; the rest are freed
+# endif
+
 # ifndef d_m3EnableCodePageRefCounting
 #   define d_m3EnableCodePageRefCounting        0
 # endif
@@ -57,6 +69,10 @@
 #   define d_m3ProfilerSlotMask                 0xFFFF
 # endif
 
+# ifndef d_m3CoalesceLocalSetGet
+#   define d_m3CoalesceLocalSetGet              1       // compile local.set X; local.get X as local.tee X
+# endif
+
 
 // profiling and tracing ------------------------------------------------------
 
@@ -64,6 +80,10 @@
 #   define d_m3EnableOpProfiling                0       // opcode usage counters
 # endif
 
+# ifndef d_m3RecordCallStack
+#   define d_m3RecordCallStack                  1       // keep a chain of the executing functions on the runtime, for sampling profilers
+# endif
+
 # ifndef d_m3EnableOpTracing
 #   define d_m3EnableOpTracing                  0       // only works with DEBUG
 # endif
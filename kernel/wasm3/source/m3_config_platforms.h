@@ -303,9 +303,11 @@
 # if defined(M3_COMPILER_GCC) || defined(M3_COMPILER_CLANG) || defined(M3_COMPILER_ICC)
 #  define UNLIKELY(x) __builtin_expect(!!(x), 0)
 #  define LIKELY(x)   __builtin_expect(!!(x), 1)
+#  define M3_SIGNAL_FENCE_RELEASE()   __atomic_signal_fence(__ATOMIC_RELEASE)
 # else
 #  define UNLIKELY(x) (x)
 #  define LIKELY(x)   (x)
+#  define M3_SIGNAL_FENCE_RELEASE()   // MSVC's volatile stores already have release semantics
 # endif
 
 
@@ -18,7 +18,7 @@ M3Result  EnsureCodePageNumLines  (IM3Compilation o, u32 i_numLines)
 
     if (NumFreeLines (o->page) < i_numLines)
     {
-        IM3CodePage page = AcquireCodePageWithCapacity (o->runtime, i_numLines);
+        IM3CodePage page = AcquireCodePageForModule (o->runtime, o->module, i_numLines);
 
         if (page)
         {
@@ -171,15 +171,10 @@ IM3Environment  m3_NewEnvironment  ()
 
 void  Environment_Release  (IM3Environment i_environment)
 {
-    IM3FuncType ftype = i_environment->funcTypes;
-
-    while (ftype)
-    {
-        IM3FuncType next = ftype->next;
-        m3Free (ftype);
-        ftype = next;
-    }                                                       m3log (runtime, "freeing %d pages from environment", CountCodePages (i_environment->pagesReleased));
+    // Function types are interned kernel-wide and outlive any one environment
+                                                            m3log (runtime, "freeing %d pages from environment", CountCodePages (i_environment->pagesReleased));
     FreeCodePages (& i_environment->pagesReleased);
+    i_environment->numBytesReleased = 0;
 }
 
 
@@ -193,30 +188,87 @@ void  m3_FreeEnvironment  (IM3Environment i_environment)
 }
 
 
-void  Environment_AddFuncType  (IM3Environment i_environment, IM3FuncType * io_funcType)
+//---------------------------------------------------------------------------------------------------------------------------------
+// Every function type in the system lives exactly once in this table, so two types are equal iff their pointers are.
+// Chained through M3FuncType.next; a type is freed once the last module using it is.
+
+#define d_m3FuncTypeBuckets     256
+
+static IM3FuncType  s_funcTypeBuckets [d_m3FuncTypeBuckets];
+
+
+static
+u32  HashFuncType  (u8 i_returnType, u32 i_numArgs, const u8 * i_argTypes)
 {
-    IM3FuncType addType = * io_funcType;
-    IM3FuncType newType = i_environment->funcTypes;
+    u32 hash = 2166136261u;     // FNV-1a
+
+    hash = (hash ^ i_returnType) * 16777619u;
+    hash = (hash ^ i_numArgs) * 16777619u;
+
+    for (u32 i = 0; i < i_numArgs; ++i)
+        hash = (hash ^ i_argTypes [i]) * 16777619u;
+
+    return hash;
+}
 
-    while (newType)
+
+IM3FuncType  FindFuncType  (u8 i_returnType, u32 i_numArgs, const u8 * i_argTypes)
+{
+    IM3FuncType type = s_funcTypeBuckets [HashFuncType (i_returnType, i_numArgs, i_argTypes) & (d_m3FuncTypeBuckets - 1)];
+
+    while (type)
     {
-        if (AreFuncTypesEqual (newType, addType))
-        {
-            m3Free (addType);
+        if (type->returnType == i_returnType and type->numArgs == i_numArgs and
+            memcmp (type->argTypes, i_argTypes, i_numArgs) == 0)
             break;
-        }
 
-        newType = newType->next;
+        type = type->next;
     }
 
-    if (newType == NULL)
+    return type;
+}
+
+
+void  InternFuncType  (IM3FuncType * io_funcType)
+{
+    IM3FuncType addType = * io_funcType;
+    IM3FuncType existing = FindFuncType (addType->returnType, addType->numArgs, addType->argTypes);
+
+    if (existing)
     {
-        newType = addType;
-        newType->next = i_environment->funcTypes;
-        i_environment->funcTypes = newType;
+        m3Free (addType);
+        existing->refCount++;
+        * io_funcType = existing;
     }
+    else
+    {
+        IM3FuncType * bucket = & s_funcTypeBuckets [HashFuncType (addType->returnType, addType->numArgs, addType->argTypes) & (d_m3FuncTypeBuckets - 1)];
+
+        addType->refCount = 1;
+        addType->next = * bucket;
+        * bucket = addType;
+    }
+}
+
 
-    * io_funcType = newType;
+void  ReleaseFuncType  (IM3FuncType i_funcType)
+{
+    if (i_funcType == NULL or --i_funcType->refCount > 0)
+        return;
+
+    IM3FuncType * link = & s_funcTypeBuckets [HashFuncType (i_funcType->returnType, i_funcType->numArgs, i_funcType->argTypes) & (d_m3FuncTypeBuckets - 1)];
+
+    while (* link != i_funcType)
+        link = & (* link)->next;
+
+    * link = i_funcType->next;
+    m3Free (i_funcType);
+}
+
+
+void  Environment_AddFuncType  (IM3Environment i_environment, IM3FuncType * io_funcType)
+{
+    InternFuncType (io_funcType);
 }
 
 
@@ -248,30 +300,37 @@ IM3CodePage RemoveCodePageOfCapacity (M3CodePage ** io_list, u32 i_minimumLineCo
 
 IM3CodePage  Environment_AcquireCodePage (IM3Environment i_environment, u32 i_minimumLineCount)
 {
-    return RemoveCodePageOfCapacity (& i_environment->pagesReleased, i_minimumLineCount);
+    IM3CodePage page = RemoveCodePageOfCapacity (& i_environment->pagesReleased, i_minimumLineCount);
+
+    if (page)
+        i_environment->numBytesReleased -= GetCodePageNumBytes (page);
+
+    return page;
 }
 
 
+// Runtimes sharing the environment pick these pages up again, so keep as many as the pool allows.
 void  Environment_ReleaseCodePages  (IM3Environment i_environment, IM3CodePage i_codePageList)
 {
-    IM3CodePage end = i_codePageList;
+    IM3CodePage page = i_codePageList;
 
-    while (end)
+    while (page)
     {
-        end->info.lineIndex = 0; // reset page
+        IM3CodePage next = page->info.next;
+        u32 numBytes = GetCodePageNumBytes (page);
 
-        IM3CodePage next = end->info.next;
-        if (not next)
-            break;
-
-        end = next;
-    }
+        if (i_environment->numBytesReleased + numBytes <= d_m3CodePagePoolMaxBytes)
+        {
+            page->info.lineIndex = 0; // reset page
+            PushCodePage (& i_environment->pagesReleased, page);
+            i_environment->numBytesReleased += numBytes;
+        }
+        else
+        {                                                           m3log (runtime, "pool full; freeing page: %d", page->info.sequence);
+            m3Free (page);
+        }
 
-    if (end)
-    {
-        // push list to front
-        end->info.next = i_environment->pagesReleased;
-        i_environment->pagesReleased = i_codePageList;
+        page = next;
     }
 }
 
@@ -674,8 +733,132 @@ _       (InitStartFunc (io_module));
 }
 
 
+M3Result  m3_TakeSnapshot  (IM3Module i_module, M3Snapshot * o_snapshot)
+{
+    M3Result result = m3Err_none;
+    M3Memory * memory;
+
+    M3_INIT (* o_snapshot);
+
+    _throwif ("module isn't loaded into a runtime", not i_module->runtime);
+
+    memory = & i_module->runtime->memory;
+
+    if (memory->mallocated)
+    {
+        o_snapshot->numPages = memory->numPages;
+        o_snapshot->memorySize = (u32) memory->mallocated->length;
+_       (m3CopyMem (& o_snapshot->memory, m3MemData (memory->mallocated), o_snapshot->memorySize));
+    }
+
+    o_snapshot->numGlobals = i_module->numGlobals;
+    if (i_module->numGlobals)
+    {
+_       (m3Alloc (& o_snapshot->globals, u64, i_module->numGlobals));
+
+        for (u32 i = 0; i < i_module->numGlobals; ++i)
+            o_snapshot->globals [i] = (u64) i_module->globals [i].intValue;
+    }
+
+    o_snapshot->tableSize = i_module->table0Size;
+    if (i_module->table0Size)
+    {
+_       (m3Alloc (& o_snapshot->table, u32, i_module->table0Size));
+
+        for (u32 i = 0; i < i_module->table0Size; ++i)
+        {
+            IM3Function function = i_module->table0 [i];
+            o_snapshot->table [i] = function ? (u32) (function - i_module->functions) : UINT32_MAX;
+        }
+    }
+
+    _catch:
+
+    if (result)
+        m3_FreeSnapshot (o_snapshot);
+
+    return result;
+}
+
+
+void  m3_FreeSnapshot  (M3Snapshot * io_snapshot)
+{
+    m3Free (io_snapshot->memory);
+    m3Free (io_snapshot->globals);
+    m3Free (io_snapshot->table);
+
+    M3_INIT (* io_snapshot);
+}
+
+
+M3Result  m3_LoadModuleFromSnapshot  (IM3Runtime io_runtime, IM3Module io_module, const M3Snapshot * i_snapshot)
+{
+    M3Result result = m3Err_none;
+    bool claimed = false;
+    M3Memory * memory = & io_runtime->memory;
+
+    _throwif (m3Err_moduleAlreadyLinked, io_module->runtime);
+    _throwif ("snapshot doesn't match module", i_snapshot->numGlobals != io_module->numGlobals);
+
+    for (u32 i = 0; i < i_snapshot->tableSize; ++i)
+        _throwif ("snapshot doesn't match module", i_snapshot->table [i] != UINT32_MAX and i_snapshot->table [i] >= io_module->numFunctions);
+
+    io_module->runtime = io_runtime;
+    claimed = true;
+
+_   (InitMemory (io_runtime, io_module));
+
+    if (i_snapshot->memorySize)
+    {
+        if (memory->numPages != i_snapshot->numPages)
+_           (ResizeMemory (io_runtime, i_snapshot->numPages));
+
+        _throwif ("snapshot doesn't fit linear memory", not memory->mallocated or i_snapshot->memorySize > memory->mallocated->length);
+
+        memcpy (m3MemData (memory->mallocated), i_snapshot->memory, i_snapshot->memorySize);
+    }
+
+    // Imported globals belong to whoever exports them; everything else comes from the snapshot.
+    for (u32 i = 0; i < io_module->numGlobals; ++i)
+    {
+        M3Global * g = & io_module->globals [i];
+
+        if (not g->imported)
+            g->intValue = (i64) i_snapshot->globals [i];
+    }
+
+    if (i_snapshot->tableSize)
+    {
+_       (m3ReallocArray (& io_module->table0, IM3Function, i_snapshot->tableSize, io_module->table0Size));
+        io_module->table0Size = i_snapshot->tableSize;
+
+        for (u32 i = 0; i < i_snapshot->tableSize; ++i)
+        {
+            u32 index = i_snapshot->table [i];
+            io_module->table0 [i] = (index == UINT32_MAX) ? NULL : & io_module->functions [index];
+        }
+    }
+
+    io_module->next = io_runtime->modules;
+    io_runtime->modules = io_module;
+
+    // The start function has already run, in the runtime the snapshot came from.
+
+    _catch:
+
+    if (result and claimed)
+        io_module->runtime = NULL;
+
+    return result;
+}
+
+
 void *  v_FindFunction  (IM3Module i_module, const char * const i_name)
 {
+    // Modules with an export section answer from its hash table; only exports are callable by name anyway.
+    if (i_module->exportTable)
+        return Module_FindExport (i_module, i_name);
+
     for (u32 i = 0; i < i_module->numFunctions; ++i)
     {
         IM3Function f = & i_module->functions [i];
@@ -718,12 +901,82 @@ M3Result  m3_FindFunction  (IM3Function * o_function, IM3Runtime i_runtime, cons
 }
 
 
+static IM3Function  NextFunctionToCompileAhead  (IM3Module io_module)
+{
+    // First whatever compiled code already calls, in the order the calls were compiled. Compiling one of
+    // these queues its own callees, so this walks the call graph breadth-first out from _start.
+    while (io_module->compileQueueHead < io_module->compileQueueTail)
+    {
+        u32 index = io_module->compileQueue [io_module->compileQueueHead++];
+        IM3Function function = & io_module->functions [index];
+
+        if (not function->compiled)
+            return function;
+    }
+
+    // Then anything reachable through call_indirect.
+    while (io_module->compileAheadTableIndex < io_module->table0Size)
+    {
+        IM3Function function = io_module->table0 [io_module->compileAheadTableIndex++];
+
+        if (function and function->module == io_module and function->wasm and not function->compiled)
+            return function;
+    }
+
+    return NULL;
+}
+
+
+M3Result  m3_CompileAhead  (IM3Module io_module, uint32_t * o_wasmBytes, bool * o_more)
+{
+    M3Result result = m3Err_none;
+
+    * o_wasmBytes = 0;
+    * o_more = true;
+
+    IM3Runtime runtime = io_module->runtime;
+
+    if (not runtime or runtime->compiling)
+        return result;
+
+    IM3Function function = NextFunctionToCompileAhead (io_module);
+
+    if (function)
+    {
+_       (Compile_Function (function));
+        * o_wasmBytes = (u32) (function->wasmEnd - function->wasm);
+    }
+    else * o_more = false;
+
+    _catch: return result;
+}
+
+
 M3Result  m3_Call  (IM3Function i_function)
 {
     return m3_CallWithArgs (i_function, 0, NULL);
 }
 
 
+// Arguments have already been stored into runtime->stack by the caller, one 64-bit slot each,
+// and the result is left in slot 0. No argument checking happens here.
+M3Result  m3_CallPrepared  (IM3Function i_function)
+{
+    M3Result result = m3Err_none;
+
+    if (i_function->compiled)
+    {
+        IM3Runtime runtime = i_function->module->runtime;
+
+        m3StackCheckInit();
+_       ((M3Result) Call (i_function->compiled, (m3stack_t) runtime->stack, runtime->memory.mallocated, d_m3OpDefaultArgs));
+    }
+    else _throw (m3Err_missingCompiledCode);
+
+    _catch: return result;
+}
+
+
 M3Result  m3_CallWithArgs  (IM3Function i_function, uint32_t i_argc, const char * const * i_argv)
 {
     M3Result result = m3Err_none;
@@ -876,7 +1129,8 @@ void  ReleaseCodePageNoTrack (IM3Runtime i_runtime, IM3CodePage i_codePage)
 }
 
 
-IM3CodePage  AcquireCodePageWithCapacity  (IM3Runtime i_runtime, u32 i_minLineCount)
+static
+IM3CodePage  AcquireCodePageSized  (IM3Runtime i_runtime, u32 i_minLineCount, u32 i_newPageLineCount)
 {
     IM3CodePage page = RemoveCodePageOfCapacity (& i_runtime->pagesOpen, i_minLineCount);
 
@@ -885,7 +1139,7 @@ IM3CodePage  AcquireCodePageWithCapacity  (IM3Runtime i_runtime, u32 i_minLineCo
         page = Environment_AcquireCodePage (i_runtime->environment, i_minLineCount);
 
         if (not page)
-            page = NewCodePage (i_minLineCount);
+            page = NewCodePage (M3_MAX (i_minLineCount, i_newPageLineCount));
 
         if (page)
             i_runtime->numCodePages++;
@@ -900,6 +1154,24 @@ IM3CodePage  AcquireCodePageWithCapacity  (IM3Runtime i_runtime, u32 i_minLineCo
 }
 
 
+IM3CodePage  AcquireCodePageWithCapacity  (IM3Runtime i_runtime, u32 i_minLineCount)
+{
+    return AcquireCodePageSized (i_runtime, i_minLineCount, i_minLineCount);
+}
+
+
+// If a new page is needed, leave room on it for the functions already queued to be compiled next (up to
+// d_m3CodeArenaMaxBytes), so callers and callees end up next to each other rather than spread over small pages.
+// Code nothing has called yet doesn't count: a process that only ever runs a few functions gets small pages.
+IM3CodePage  AcquireCodePageForModule  (IM3Runtime i_runtime, IM3Module i_module, u32 i_minLineCount)
+{
+    u64 arenaLines = i_minLineCount + (u64) i_module->numQueuedBytes * d_m3CodeLinesPerWasmByte;
+    arenaLines = M3_MIN (arenaLines, d_m3CodeArenaMaxBytes / sizeof (code_t));
+
+    return AcquireCodePageSized (i_runtime, i_minLineCount, (u32) arenaLines);
+}
+
+
 IM3CodePage  AcquireCodePage  (IM3Runtime i_runtime)
 {
     return AcquireCodePageWithCapacity (i_runtime, d_m3CodePageFreeLinesThreshold);
@@ -929,6 +1201,34 @@ void  ReleaseCodePage  (IM3Runtime i_runtime, IM3CodePage i_codePage)
 }
 
 
+static
+void  AddCodePageInfo  (M3CodePageInfo * io_info, IM3CodePage i_list)
+{
+    while (i_list)
+    {
+        io_info->numPages++;
+        io_info->numBytes += GetCodePageNumBytes (i_list);
+        io_info->numLines += i_list->info.numLines;
+        io_info->numLinesUsed += i_list->info.lineIndex;
+
+        i_list = i_list->info.next;
+    }
+}
+
+
+void  m3_GetCodePageInfo  (IM3Runtime i_runtime, M3CodePageInfo * o_info)
+{
+    M3_INIT (* o_info);
+
+    AddCodePageInfo (o_info, i_runtime->pagesOpen);
+    AddCodePageInfo (o_info, i_runtime->pagesFull);
+
+    IM3Environment env = i_runtime->environment;
+    o_info->numPooledPages = CountCodePages (env->pagesReleased);
+    o_info->numPooledBytes = env->numBytesReleased;
+}
+
+
 #if d_m3VerboseLogs
 M3Result  m3Error  (M3Result i_result, IM3Runtime i_runtime, IM3Module i_module, IM3Function i_function,
                     const char * const i_file, u32 i_lineNum, const char * const i_errorMessage, ...)
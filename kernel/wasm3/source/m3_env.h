@@ -18,6 +18,7 @@ d_m3BeginExternC
 typedef struct M3FuncType
 {
     struct M3FuncType *     next;
+    u32                     refCount;           // modules using this interned type
 
     u32                     numArgs;
     u8                      returnType;
@@ -67,6 +68,7 @@ typedef struct M3Function
     u16                     numConstantBytes;
 
     bool                    ownsWasmCode;
+    bool                    queuedForCompile;   // already on its module's compile-ahead queue
 }
 M3Function;
 
@@ -148,6 +150,13 @@ typedef M3Global *          IM3Global;
 
 
 //---------------------------------------------------------------------------------------------------------------------------------
+typedef struct M3ExportEntry
+{
+    cstr_t                  name;               // NULL marks an empty slot
+    u32                     functionIndex;
+}
+M3ExportEntry;
+
 typedef struct M3Module
 {
     struct M3Runtime *      runtime;
@@ -180,6 +189,16 @@ typedef struct M3Module
     IM3Function *           table0;
     u32                     table0Size;
 
+    u32                     exportTableSize;    // power of two; open addressing over exported function names
+    M3ExportEntry *         exportTable;
+
+    u32                     numQueuedBytes;     // wasm bytes of queued functions not compiled yet; sizes code arenas
+
+    u32 *                   compileQueue;       // function indices seen as call targets before they were compiled
+    u32                     compileQueueHead;
+    u32                     compileQueueTail;
+    u32                     compileAheadTableIndex; // where m3_CompileAhead resumes in table0 once the queue is empty
+
     M3MemoryInfo            memoryInfo;
     bool                    memoryImported;
 
@@ -194,6 +213,13 @@ M3Result                    Module_AddGlobal            (IM3Module io_module, IM
 M3Result                    Module_AddFunction          (IM3Module io_module, u32 i_typeIndex, IM3ImportInfo i_importInfo /* can be null */);
 IM3Function                 Module_GetFunction          (IM3Module i_module, u32 i_functionIndex);
 
+M3Result                    Module_ReserveExports       (IM3Module io_module, u32 i_numExports);
+void                        Module_AddExport            (IM3Module io_module, cstr_t i_name, u32 i_functionIndex);
+IM3Function                 Module_FindExport           (IM3Module i_module, cstr_t i_name);
+
+void                        Module_QueueForCompile      (IM3Module io_module, IM3Function i_function);
+void                        Module_ReleaseFuncTypes     (IM3Module io_module);
+
 //---------------------------------------------------------------------------------------------------------------------------------
 
 static const u32 c_m3NumTypesPerPage = 8;
@@ -204,9 +230,8 @@ typedef struct M3Environment
 {
 //    struct M3Runtime *      runtimes;
 
-    IM3FuncType             funcTypes;          // linked list
-
     M3CodePage *            pagesReleased;
+    u32                     numBytesReleased;   // capped at d_m3CodePagePoolMaxBytes
 }
 M3Environment;
 
@@ -215,13 +240,29 @@ void                        Environment_Release         (IM3Environment i_enviro
 // takes ownership of io_funcType and returns a pointer to the persistent version (could be same or different)
 void                        Environment_AddFuncType     (IM3Environment i_environment, IM3FuncType * io_funcType);
 
+// Function types are interned kernel-wide, across environments and runtimes, so that type equality is a pointer
+// compare: for call_indirect checks, host function linking and code shared between modules alike.
+// Interning takes a reference; each module gives its types back with ReleaseFuncType when it is freed.
+void                        InternFuncType              (IM3FuncType * io_funcType);
+void                        ReleaseFuncType             (IM3FuncType i_funcType);
+IM3FuncType                 FindFuncType                (u8 i_returnType, u32 i_numArgs, const u8 * i_argTypes);
+
 //---------------------------------------------------------------------------------------------------------------------------------
 
-// OPTZ: function types need to move to the runtime structure so that all modules can share types
-// then type equality can be a simple pointer compare for indirect call checks
+// One per active call, living on the C stack of that call's op_Entry; a tail call reuses its caller's.
+// Interrupt handlers may walk the chain at any time, so it must be consistent between any two instructions.
+// Calls entered before recording was switched on aren't on it, so the first stacks may lack outer frames.
+typedef struct M3CallFrame
+{
+    IM3Function             function;
+    struct M3CallFrame *    caller;
+}
+M3CallFrame;
+
 typedef struct M3Runtime
 {
     M3Compilation           compilation;
+    bool                    compiling;      // compilation is in use; m3_CompileAhead must not start another
 
     IM3Environment          environment;
 
@@ -246,6 +287,11 @@ typedef struct M3Runtime
     u32                     memoryLimit;
 
     M3ErrorInfo             error;
+#if d_m3RecordCallStack
+    M3CallFrame * volatile  callStack;      // innermost first; only kept while recordCallStack is set
+    bool                    recordCallStack;
+    bool                    tailCall;       // set by the return_call ops so the callee's op_Entry reuses the top frame; stale unless recording
+#endif
 #if d_m3VerboseLogs
     char                    error_message[256];
 #endif
@@ -265,6 +311,7 @@ void *                      v_FindFunction              (IM3Module i_module, con
 
 IM3CodePage                 AcquireCodePage             (IM3Runtime io_runtime);
 IM3CodePage                 AcquireCodePageWithCapacity (IM3Runtime io_runtime, u32 i_lineCount);
+IM3CodePage                 AcquireCodePageForModule    (IM3Runtime io_runtime, IM3Module i_module, u32 i_lineCount);
 void                        ReleaseCodePage             (IM3Runtime io_runtime, IM3CodePage i_codePage);
 
 M3Result                    m3Error                     (M3Result i_result, IM3Runtime i_runtime, IM3Module i_module, IM3Function i_function, const char * const i_file, u32 i_lineNum, const char * const i_errorMessage, ...);
@@ -114,10 +114,70 @@ d_m3OpDef  (CallIndirect)
 }
 
 
+// Tail calls. The arguments were built above this frame like for any call; slide them down over the frame and hand
+// it to the callee, whose result then lands in our own return slot. The C call is in tail position too, so neither
+// the wasm stack nor the native one grows -- as long as the compiler turns it, and the return in op_Entry's
+// tailCall branch, into jumps. C doesn't promise that, and op_Entry takes a local's address on its other path.
+d_m3OpDef  (ReturnCall)
+{
+    pc_t callPC                 = immediate (pc_t);
+    i32 stackOffset             = immediate (i32);
+    u32 numArgSlots             = immediate (u32);
+
+    memmove (_sp, _sp + stackOffset, numArgSlots * sizeof (m3slot_t));
+
+#   if d_m3RecordCallStack
+        m3MemRuntime (_mem)->tailCall = true;
+#   endif
+
+    return Call (callPC, _sp, _mem, d_m3OpDefaultArgs);
+}
+
+
+d_m3OpDef  (ReturnCallIndirect)
+{
+    u32 tableIndex              = slot (u32);
+    IM3Module module            = immediate (IM3Module);
+    IM3FuncType type            = immediate (IM3FuncType);
+    i32 stackOffset             = immediate (i32);
+    u32 numArgSlots             = immediate (u32);
+
+    if (UNLIKELY(tableIndex >= module->table0Size))
+        return m3Err_trapTableIndexOutOfRange;
+
+    IM3Function function = module->table0 [tableIndex];
+
+    if (UNLIKELY(not function))
+        return m3Err_trapTableElementIsNull;
+
+    if (UNLIKELY(type != function->funcType))
+        return m3Err_trapIndirectCallTypeMismatch;
+
+    if (UNLIKELY(not function->compiled))
+    {
+        m3ret_t r = Compile_Function (function);
+        if (r)
+            return r;
+    }
+
+    memmove (_sp, _sp + stackOffset, numArgSlots * sizeof (m3slot_t));
+
+#   if d_m3RecordCallStack
+        m3MemRuntime (_mem)->tailCall = true;
+#   endif
+
+    return Call (function->compiled, _sp, _mem, d_m3OpDefaultArgs);
+}
+
+
 d_m3OpDef  (CallRawFunction)
 {
     M3RawCall call = (M3RawCall) (* _pc++);
 
+#   if d_m3RecordCallStack
+        m3MemRuntime (_mem)->tailCall = false;
+#   endif
+
     m3ret_t possible_trap = call (m3MemRuntime(_mem), (u64 *) _sp, m3MemData(_mem));
     return possible_trap;
 }
@@ -127,6 +187,10 @@ d_m3OpDef  (CallRawFunctionEx)
     M3RawCallEx call = (M3RawCallEx) (* _pc++);
     void * cookie = immediate (void *);
 
+#   if d_m3RecordCallStack
+        m3MemRuntime (_mem)->tailCall = false;
+#   endif
+
     m3ret_t possible_trap = call (m3MemRuntime(_mem), (u64 *)_sp, m3MemData(_mem), cookie);
     return possible_trap;
 }
@@ -195,6 +259,31 @@ d_m3OpDef  (Compile)
 
 
 
+// The tail-call counterpart of op_Compile
+d_m3OpDef  (ReturnCompile)
+{
+    rewrite_op (op_ReturnCall);
+
+    IM3Function function        = immediate (IM3Function);
+
+    m3ret_t result = m3Err_none;
+
+    if (UNLIKELY(not function->compiled))
+        result = Compile_Function (function);
+
+    if (not result)
+    {
+        * ((void**) --_pc) = (void*) (function->compiled);
+        --_pc;
+        result = nextOpDirect ();
+    }
+    else ReportError2 (function, result);
+
+    return result;
+}
+
+
+
 d_m3OpDef  (Entry)
 {
     d_m3ClearRegisters
@@ -222,6 +311,38 @@ d_m3OpDef  (Entry)
             memcpy (stack, function->constants, function->numConstantBytes);
         }
 
+#       if d_m3RecordCallStack
+            // Frames are only kept while someone samples them. Otherwise this stays a plain tail call into the
+            // body, which leaves no native frame of ours behind.
+            IM3Runtime runtime = m3MemRuntime (_mem);
+
+            if (UNLIKELY(runtime->recordCallStack))
+            {
+                bool tailCall = runtime->tailCall;
+                runtime->tailCall = false;
+
+                // A tail call takes over its caller's frame instead of nesting a new one, and returns straight
+                // through here, so neither the chain nor the native stack grows. (No frame to take over if
+                // recording only started since the caller was entered.)
+                if (tailCall and runtime->callStack)
+                {
+                    runtime->callStack->function = function;
+                    return nextOpDirect ();
+                }
+
+                M3CallFrame frame = { function, runtime->callStack };
+
+                // An interrupt may walk the chain as soon as the frame is on it, so it must be filled in first.
+                M3_SIGNAL_FENCE_RELEASE ();
+                runtime->callStack = & frame;
+
+                m3ret_t r = nextOpDirect ();
+
+                runtime->callStack = frame.caller;
+                return r;
+            }
+#       endif
+
         m3ret_t r = nextOpDirect ();
 
 #       if d_m3LogExec
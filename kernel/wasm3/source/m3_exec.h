@@ -636,6 +636,9 @@ d_m3Op  (ContinueLoopIf)
 d_m3OpDecl  (Compile)
 d_m3OpDecl  (Call)
 d_m3OpDecl  (CallIndirect)
+d_m3OpDecl  (ReturnCompile)
+d_m3OpDecl  (ReturnCall)
+d_m3OpDecl  (ReturnCallIndirect)
 d_m3OpDecl  (CallRawFunction)
 d_m3OpDecl  (CallRawFunctionEx)
 d_m3OpDecl  (Entry)
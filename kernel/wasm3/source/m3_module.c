@@ -19,6 +19,37 @@ void Module_FreeFunctions (IM3Module i_module)
 }
 
 
+// Give back the module's references to its interned types. Entries a failed parse never reached are null.
+void  Module_ReleaseFuncTypes  (IM3Module io_module)
+{
+    if (io_module->funcTypes)
+    {
+        for (u32 i = 0; i < io_module->numFuncTypes; ++i)
+            ReleaseFuncType (io_module->funcTypes [i]);
+    }
+
+    m3Free (io_module->funcTypes);
+    io_module->numFuncTypes = 0;
+}
+
+
+static
+void  Module_FreeExports  (IM3Module i_module)
+{
+    for (u32 i = 0; i < i_module->exportTableSize; ++i)
+    {
+        M3ExportEntry * entry = & i_module->exportTable [i];
+
+        // Names handed over to the function are freed along with it
+        if (entry->name and entry->name != i_module->functions [entry->functionIndex].name)
+            m3Free (entry->name);
+    }
+
+    m3Free (i_module->exportTable);
+    i_module->exportTableSize = 0;
+}
+
+
 void  m3_FreeModule  (IM3Module i_module)
 {
     if (i_module)
@@ -26,11 +57,14 @@ void  m3_FreeModule  (IM3Module i_module)
         m3log (module, "freeing module: %s (funcs: %d; segments: %d)",
                i_module->name, i_module->numFunctions, i_module->numDataSegments);
 
+        Module_FreeExports (i_module);
         Module_FreeFunctions (i_module);
 
+        m3Free (i_module->compileQueue);
+
         m3Free (i_module->functions);
         m3Free (i_module->imports);
-        m3Free (i_module->funcTypes);
+        Module_ReleaseFuncTypes (i_module);
         m3Free (i_module->dataSegments);
         m3Free (i_module->table0);
 
@@ -100,3 +134,90 @@ IM3Function  Module_GetFunction  (IM3Module i_module, u32 i_functionIndex)
 
     return func;
 }
+
+
+static
+u32  HashExportName  (cstr_t i_name)
+{
+    u32 hash = 2166136261u;     // FNV-1a
+
+    while (* i_name)
+        hash = (hash ^ (u8) * i_name++) * 16777619u;
+
+    return hash;
+}
+
+
+M3Result  Module_ReserveExports  (IM3Module io_module, u32 i_numExports)
+{
+    M3Result result = m3Err_none;
+
+    // At most half full, so probe sequences stay short
+    u32 size = 4;
+    while (size < i_numExports * 2)
+        size *= 2;
+
+_   (m3Alloc (& io_module->exportTable, M3ExportEntry, size));
+    io_module->exportTableSize = size;
+
+    _catch: return result;
+}
+
+
+// Takes ownership of i_name. The table must have been sized with Module_ReserveExports.
+void  Module_AddExport  (IM3Module io_module, cstr_t i_name, u32 i_functionIndex)
+{
+    u32 mask = io_module->exportTableSize - 1;
+    u32 slot = HashExportName (i_name) & mask;
+
+    while (io_module->exportTable [slot].name)
+        slot = (slot + 1) & mask;
+
+    io_module->exportTable [slot].name = i_name;
+    io_module->exportTable [slot].functionIndex = i_functionIndex;
+}
+
+
+IM3Function  Module_FindExport  (IM3Module i_module, cstr_t i_name)
+{
+    if (not i_module->exportTableSize)
+        return NULL;
+
+    u32 mask = i_module->exportTableSize - 1;
+    u32 slot = HashExportName (i_name) & mask;
+
+    while (i_module->exportTable [slot].name)
+    {
+        M3ExportEntry * entry = & i_module->exportTable [slot];
+
+        if (strcmp (entry->name, i_name) == 0)
+            return Module_GetFunction (i_module, entry->functionIndex);
+
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+
+// Remember a function that compiled code calls but that hasn't been compiled yet, so m3_CompileAhead
+// can get to it before the call does. Each function is queued at most once, so numFunctions entries
+// always suffice. If the queue can't be allocated we just lose the hint.
+void  Module_QueueForCompile  (IM3Module io_module, IM3Function i_function)
+{
+    if (i_function->compiled or i_function->queuedForCompile or not i_function->wasm)
+        return;
+
+    if (i_function < io_module->functions or i_function >= io_module->functions + io_module->numFunctions)
+        return;
+
+    if (not io_module->compileQueue)
+    {
+        if (m3Alloc (& io_module->compileQueue, u32, io_module->numFunctions))
+            return;
+    }
+
+    i_function->queuedForCompile = true;
+    io_module->compileQueue [io_module->compileQueueTail++] = (u32) (i_function - io_module->functions);
+    io_module->numQueuedBytes += (u32) (i_function->wasmEnd - i_function->wasm);
+}
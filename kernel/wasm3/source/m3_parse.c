@@ -86,6 +86,7 @@ _               (NormalizeType (& ftype->returnType, returnType));
 
             Environment_AddFuncType (io_module->environment, & ftype);
             io_module->funcTypes [i] = ftype;
+            ftype = NULL; // interned now; not ours to free if a later type fails to parse
         }
     }
 
@@ -94,8 +95,7 @@ _               (NormalizeType (& ftype->returnType, returnType));
     if (result)
     {
         m3Free (ftype);
-        m3Free (io_module->funcTypes);
-        io_module->numFuncTypes = 0;
+        Module_ReleaseFuncTypes (io_module);
     }
 
     return result;
@@ -200,6 +200,9 @@ M3Result  ParseSection_Export  (IM3Module io_module, bytes_t i_bytes, cbytes_t
 
     u32 numExports;
 _   (ReadLEB_u32 (& numExports, & i_bytes, i_end));                                 m3log (parse, "** Export [%d]", numExports);
+    _throwif ("export count exceeds section size", numExports > (u32) (i_end - i_bytes));
+
+_   (Module_ReserveExports (io_module, numExports));
 
     for (u32 i = 0; i < numExports; ++i)
     {
@@ -213,11 +216,17 @@ _       (ReadLEB_u32 (& index, & i_bytes, i_end));
 
         if (exportKind == d_externalKind_function)
         {
-            if (not io_module->functions [index].name)
+            if (index >= io_module->numFunctions)
             {
-                io_module->functions [index].name = utf8;
-                utf8 = NULL; // ownership transfered to M3Function
+                m3Free (utf8);
+                _throw ("export function index out of bounds");
             }
+
+            if (not io_module->functions [index].name)
+                io_module->functions [index].name = utf8; // shared with the export table, which frees it last
+
+            Module_AddExport (io_module, utf8, index);
+            utf8 = NULL; // ownership transfered to the export table
         }
 
         m3Free (utf8);
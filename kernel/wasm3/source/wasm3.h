@@ -15,6 +15,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <inttypes.h>
 
 #if defined(__cplusplus)
@@ -168,6 +169,21 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
                                                      uint32_t               i_memoryIndex);
     // Wasm currently only supports one memory region. i_memoryIndex should be zero.
 
+    typedef struct M3CodePageInfo
+    {
+        uint32_t            numPages;           // pages held by the runtime, outside of a compilation in progress
+        uint32_t            numBytes;
+        uint32_t            numLines;
+        uint32_t            numLinesUsed;
+
+        uint32_t            numPooledPages;     // released pages the environment keeps for its runtimes
+        uint32_t            numPooledBytes;
+    }
+    M3CodePageInfo;
+
+    void                m3_GetCodePageInfo          (IM3Runtime             i_runtime,
+                                                     M3CodePageInfo *       o_info);
+
 //-------------------------------------------------------------------------------------------------------------------------------
 //  modules
 //-------------------------------------------------------------------------------------------------------------------------------
@@ -184,6 +200,33 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     M3Result            m3_LoadModule               (IM3Runtime io_runtime,  IM3Module io_module);
     //  LoadModule transfers ownership of a module to the runtime. Do not free modules once successfully imported into the runtime
 
+    // The state a module's instantiation and initialisers left behind: linear memory, globals and table.
+    // Compiled code isn't included; it points into the runtime it was compiled for.
+    typedef struct M3Snapshot
+    {
+        uint32_t                numPages;
+        uint32_t                memorySize;
+        uint8_t *               memory;
+
+        uint32_t                numGlobals;
+        uint64_t *              globals;
+
+        uint32_t                tableSize;
+        uint32_t *              table;          // function indices; UINT32_MAX for empty elements
+    }
+    M3Snapshot;
+
+    M3Result            m3_TakeSnapshot             (IM3Module              i_module,
+                                                     M3Snapshot *           o_snapshot);
+
+    void                m3_FreeSnapshot             (M3Snapshot *           io_snapshot);
+
+    // Like m3_LoadModule, but instead of initialising memory, globals and table and running the start function,
+    // copies them from a snapshot of the same module taken in another runtime.
+    M3Result            m3_LoadModuleFromSnapshot   (IM3Runtime             io_runtime,
+                                                     IM3Module              io_module,
+                                                     const M3Snapshot *     i_snapshot);
+
     typedef const void * (* M3RawCall) (IM3Runtime runtime, uint64_t * _sp, void * _mem);
 
     M3Result            m3_LinkRawFunction          (IM3Module              io_module,
@@ -203,6 +246,26 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
                                                      M3RawCallEx            i_function,
                                                      void *                 i_cookie);
 
+    // What an import resolves to. returnType and argTypes use the c_m3Type_* codes, so the signature can be
+    // checked with a memcmp instead of parsing a signature string.
+    typedef struct M3ImportBinding
+    {
+        M3RawCallEx             function;
+        void *                  cookie;
+        uint8_t                 returnType;
+        uint8_t                 numArgs;
+        const uint8_t *         argTypes;
+    }
+    M3ImportBinding;
+
+    typedef bool (* M3ImportResolver) (void * i_userdata, const char * i_moduleName, const char * i_fieldName, M3ImportBinding * o_binding);
+
+    // m3_LinkImports walks the module's imports once, asking i_resolver about each one that isn't linked yet.
+    // Imports it doesn't know, or whose signature doesn't match, are left unlinked.
+    M3Result            m3_LinkImports              (IM3Module              io_module,
+                                                     M3ImportResolver       i_resolver,
+                                                     void *                 i_userdata);
+
 //-------------------------------------------------------------------------------------------------------------------------------
 //  functions
 //-------------------------------------------------------------------------------------------------------------------------------
@@ -212,8 +275,16 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
                                                      IM3Runtime             i_runtime,
                                                      const char * const     i_functionName);
 
+    // m3_CompileAhead compiles one function the module hasn't needed yet, preferring ones its compiled code
+    // already calls. *o_wasmBytes is the size of the bytecode compiled, 0 if nothing was (the runtime may be
+    // mid-compile already). *o_more goes false once there is nothing left to compile.
+    M3Result            m3_CompileAhead             (IM3Module              io_module,
+                                                     uint32_t *             o_wasmBytes,
+                                                     bool *                 o_more);
+
     M3Result            m3_Call                     (IM3Function i_function);
     M3Result            m3_CallWithArgs             (IM3Function i_function, uint32_t i_argc, const char * const * i_argv);
+    M3Result            m3_CallPrepared             (IM3Function i_function);
 
     // IM3Functions are valid during the lifetime of the originating runtime
 